@@ -10,6 +10,10 @@
     // Don't include these CRT warnings as they aren't cross-platform relevant.
     #define _CRT_SECURE_NO_WARNINGS
 #endif
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    // For CPU affinity of the NUMA-aware decoder
+    #define _GNU_SOURCE
+#endif
 
 // General library includes
 #include <stdio.h>
@@ -30,6 +34,7 @@
 #if defined(_WIN32) && !defined(__MINGW32__)
   #include <windows.h>
   #include <malloc.h>
+  #include <io.h>
 
   /* stdint.h only available in VS2010 (VC++ 16.0) and newer */
   #if defined(_MSC_VER) && _MSC_VER < 1600
@@ -49,23 +54,69 @@
   #include <stdint.h>
   #include <unistd.h>
   #include <inttypes.h>
+  #include <sys/mman.h>
 #endif  /* _WIN32 */
 
 
-// Not currently using pthreads in mrcz, just blosc
-//#if defined(_WIN32) && !defined(__GNUC__)
-//  #include "win32/pthread.h"
-//  #include "win32/pthread.c"
-//#else
-//  #include <pthread.h>
-//#endif
+// pthreads is used for file-level parallelism (blosc threads within a chunk). 
+// MSVC builds fall back to serial loops.
+#if !defined(_WIN32) || defined(__MINGW32__)
+  #include <pthread.h>
+  #include <dirent.h>
+  #define MRCZ_HAVE_PTHREADS
+#endif
+
+// Volumes can be decompressed into POSIX shared memory for other processes.
+#if !defined(_WIN32)
+  #include <fcntl.h>
+  #define MRCZ_HAVE_SHM
+#endif
+
+// `mrcz watch` picks up new files in a directory through inotify.
+#if defined(__linux__) && defined(MRCZ_HAVE_PTHREADS)
+  #include <sys/inotify.h>
+  #include <poll.h>
+  #include <signal.h>
+  #define MRCZ_HAVE_INOTIFY
+#endif
+
+// NUMA-aware decompression pins threads using the node topology in sysfs.
+#if defined(__linux__) && defined(MRCZ_HAVE_PTHREADS)
+  #include <sched.h>
+  #define MRCZ_HAVE_NUMA
+#endif
+
+// SSE2 is used for the MRCZ filter kernels, with scalar fallbacks.
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define MRCZ_HAVE_SSE2
+#endif
+
+// The SSE4.2 crc32 instruction is used for chunk checksums when the CPU has it.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #include <nmmintrin.h>
+  #define MRCZ_HAVE_CRC32C_HW
+#endif
+
+// Trained zstd dictionaries (MRCZ_FLAG_DICTIONARY) call libzstd directly, as 
+// blosc1 has no way to pass one through.  Enabled with CMake USE_ZSTD_DICT.
+#if defined(MRCZ_HAVE_ZSTD_DICT)
+  #include <zstd.h>
+  #include <zdict.h>
+#endif
+
+// Binary mode for piping through stdin and stdout on Windows
+#if defined(_WIN32)
+  #include <fcntl.h>
+  #include <io.h>
+#endif
 
 // MRCZ Module includes
 #include "mrcz.h"
 
 mrcHeader* mrcHeader_new()
 {
-    mrcHeader *self = malloc( sizeof( *self ) );
+    mrcHeader *self = calloc( 1, sizeof( *self ) );
 
     // Set default values for blosc
     //self->blosc_threads = BLOSC_DEFAULT_THREADS;
@@ -80,7 +131,7 @@ mrcHeader* mrcHeader_new()
 
 mrcVolume* mrcVolume_new( mrcHeader *header, void *in_array )
 {
-    mrcVolume *self = (mrcVolume*)malloc( sizeof(*self) );
+    mrcVolume *self = (mrcVolume*)calloc( 1, sizeof(*self) );
     if( header == NULL )
     {
         self->header = mrcHeader_new();
@@ -93,7 +144,7 @@ mrcVolume* mrcVolume_new( mrcHeader *header, void *in_array )
      // 'Private' data variables
     if( in_array != NULL )
     {
-        switch( header->mrcType )
+        switch( self->header->mrcType )
         {
         case MRC_INT8:
             self->_i1 = (int8_t*)in_array;
@@ -119,6 +170,82 @@ mrcVolume* mrcVolume_new( mrcHeader *header, void *in_array )
     return self;
 }
 
+void* _alignedMalloc( size_t nbytes, void *opaque )
+{   // Default allocator for volume data: MRCZ_ALIGNMENT-aligned, and 
+    // hugepage-aligned and -advised for arrays of at least one hugepage.
+    void *ptr = NULL;
+    (void)opaque;
+#if defined(_WIN32) && !defined(__MINGW32__)
+    ptr = _aligned_malloc( nbytes, MRCZ_ALIGNMENT );
+#else
+    size_t alignment = nbytes >= MRCZ_HUGEPAGE_BYTES ? MRCZ_HUGEPAGE_BYTES : MRCZ_ALIGNMENT;
+    if( posix_memalign( &ptr, alignment, nbytes ) != 0 )
+        return NULL;
+  #if defined(MADV_HUGEPAGE)
+    if( nbytes >= MRCZ_HUGEPAGE_BYTES )
+        madvise( ptr, nbytes - nbytes % MRCZ_HUGEPAGE_BYTES, MADV_HUGEPAGE );
+  #endif
+#endif
+    return ptr;
+}
+
+void _alignedFree( void *ptr, void *opaque )
+{
+    (void)opaque;
+#if defined(_WIN32) && !defined(__MINGW32__)
+    _aligned_free( ptr );
+#else
+    free( ptr );
+#endif
+}
+
+uint8_t* _mrcVolume_alloc( mrcVolume *self, size_t nbytes )
+{   // Allocate the data array for header->mrcType with the volume's allocator.
+    // Returns NULL on failure.
+    uint8_t *ptr;
+    if( self->allocator.malloc != NULL )
+        ptr = (uint8_t*)self->allocator.malloc( nbytes, self->allocator.opaque );
+    else
+        ptr = (uint8_t*)_alignedMalloc( nbytes, NULL );
+    if( ptr == NULL )
+        return NULL;
+
+    if( self->allocator.flags & MRCZ_ALLOC_PREFAULT )
+    {   // Touch every page now rather than on first write
+        for( size_t i = 0; i < nbytes; i += 4096 )
+            ptr[i] = 0;
+    }
+
+    switch( self->header->mrcType )
+    {
+        case MRC_INT8:
+            self->_i1 = (int8_t*)ptr;
+            break;
+        case MRC_INT16:
+            self->_i2 = (int16_t*)ptr;
+            break;
+        case MRC_FLOAT32:
+            self->_f4 = (float*)ptr;
+            break;
+        case MRC_COMPLEX64:
+#if defined(_WIN32) && !defined(__MINGW32__)
+            self->_c8 = (_Fcomplex*)ptr;
+#else
+            self->_c8 = (float complex*)ptr;
+#endif
+            break;
+        case MRC_UINT16:
+            self->_u2 = (uint16_t*)ptr;
+            break;
+        default:
+            if( self->allocator.free != NULL )
+                self->allocator.free( ptr, self->allocator.opaque );
+            else
+                _alignedFree( ptr, NULL );
+            return NULL;
+    }
+    return ptr;
+}
 
 void* mrcVolume_data( mrcVolume *self )
 {
@@ -138,9 +265,9 @@ void* mrcVolume_data( mrcVolume *self )
     return NULL;
 }
 
-size_t mrcVolume_itemsize( mrcVolume *self )
+size_t mrcHeader_itemsize( mrcHeader *self )
 {   // Can't we do this with a macro?
-    switch( self->header->mrcType )
+    switch( self->mrcType )
     {
         case MRC_INT8:
             return 1;
@@ -156,15 +283,24 @@ size_t mrcVolume_itemsize( mrcVolume *self )
     return 0;
 }
 
+size_t mrcVolume_itemsize( mrcVolume *self )
+{
+    return mrcHeader_itemsize( self->header );
+}
+
 void mrcVolume_free( mrcVolume *self )
 {
+    void (*freeData)( void*, void* ) = self->allocator.free != NULL ? self->allocator.free : _alignedFree;
+    void *arrays[] = { self->_u1, self->_i1, self->_u2, self->_i2, self->_f4, self->_c8 };
+
+    if( self->cache != NULL )
+        _mrczSliceCache_free( self->cache );
     free( self->header );
-    free( self->_u1 );
-    free( self->_u2 );
-    free( self->_i1 );
-    free( self->_i1 );
-    free( self->_f4 );
-    free( self->_c8 );
+    for( size_t i = 0; i < sizeof(arrays)/sizeof(arrays[0]); i++ )
+    {
+        if( arrays[i] != NULL )
+            freeData( arrays[i], self->allocator.opaque );
+    }
     free( self );
 }
 
@@ -183,10 +319,308 @@ int getNumCPU()
 #endif
 }
 
-int _parseStandardHeader( uint8_t *headerBytes, mrcHeader* header, char *metaname )
+const char* _compressorName( int32_t compressor )
+{
+    switch( compressor )
+    {
+        case(BLOSC_COMPRESSOR_NONE):
+            return (const char*)BLOSC_NONE_COMPNAME;
+        case(BLOSC_COMRPRESSOR_BLOSCLZ):
+            return (const char*)BLOSC_BLOSCLZ_COMPNAME;
+        case(BLOSC_COMPRESSOR_LZ4):
+            return (const char*)BLOSC_LZ4_COMPNAME;
+        case(BLOSC_COMPRESSOR_LZ4HC):
+            return (const char*)BLOSC_LZ4HC_COMPNAME;
+        case(BLOSC_COMPRESSOR_SNAPPY):
+            return (const char*)BLOSC_SNAPPY_COMPNAME;
+        case(BLOSC_COMPRESSOR_ZLIB):
+            return (const char*)BLOSC_ZLIB_COMPNAME;
+        case(BLOSC_COMPRESSOR_ZSTD):
+            return (const char*)BLOSC_ZSTD_COMPNAME;
+    }
+    return NULL;
+}
+
+int32_t _compressorCode( const char *name )
+{   // Inverse of _compressorName, or -1 for an unknown name
+    const int32_t codes[] = { BLOSC_COMPRESSOR_NONE, BLOSC_COMRPRESSOR_BLOSCLZ, BLOSC_COMPRESSOR_LZ4, 
+        BLOSC_COMPRESSOR_LZ4HC, BLOSC_COMPRESSOR_SNAPPY, BLOSC_COMPRESSOR_ZLIB, BLOSC_COMPRESSOR_ZSTD };
+    for( size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++ )
+    {
+        if( strcmp( name, _compressorName( codes[i] ) ) == 0 )
+            return codes[i];
+    }
+    return -1;
+}
+
+int _validHeader( mrcHeader *header )
+{   // Cheap sanity check so that scanning a directory can skip non-MRC files.
+    if( header->dimensions[0] <= 0 || header->dimensions[1] <= 0 || header->dimensions[2] <= 0 )
+        return 0;
+    if( mrcHeader_itemsize( header ) == 0 )
+        return 0;
+    if( header->blosc_compressor < BLOSC_COMPRESSOR_NONE || header->blosc_compressor > BLOSC_COMPRESSOR_ZSTD )
+        return 0;
+    if( header->extendedHeaderSize < 0 )
+        return 0;
+    return 1;
+}
+
+#if defined(MRCZ_HAVE_PTHREADS)
+typedef struct _parallelForState
+{
+    pthread_mutex_t lock;
+    int64_t next;
+    int64_t nItems;
+    void (*func)( void *arg, int64_t index );
+    void *arg;
+} _parallelForState;
+
+static void* _parallelForWorker( void *arg )
+{
+    _parallelForState *state = (_parallelForState*)arg;
+    int64_t index;
+    while( 1 )
+    {
+        pthread_mutex_lock( &state->lock );
+        index = state->next++;
+        pthread_mutex_unlock( &state->lock );
+        if( index >= state->nItems )
+            break;
+        state->func( state->arg, index );
+    }
+    return NULL;
+}
+#endif
+
+void _parallelFor( int64_t nItems, int n_threads, void (*func)( void *arg, int64_t index ), void *arg )
+{   // Call func( arg, i ) for i in [0, nItems) from a pool of n_threads workers.
+    // Items are handed out one at a time, so func should do a reasonable 
+    // amount of work per call (e.g. one file or one slice).
+#if defined(MRCZ_HAVE_PTHREADS)
+    _parallelForState state;
+    pthread_t *threads;
+    int started = 0;
+
+    if( n_threads > nItems )
+        n_threads = (int)nItems;
+    if( n_threads > 1 )
+    {
+        pthread_mutex_init( &state.lock, NULL );
+        state.next = 0;
+        state.nItems = nItems;
+        state.func = func;
+        state.arg = arg;
+        // The calling thread is one of the workers.
+        threads = malloc( (n_threads-1) * sizeof(pthread_t) );
+        for( int t = 0; t < n_threads-1; t++ )
+        {
+            if( pthread_create( &threads[started], NULL, _parallelForWorker, &state ) == 0 )
+                started++;
+        }
+        _parallelForWorker( &state );
+        for( int t = 0; t < started; t++ )
+            pthread_join( threads[t], NULL );
+        free( threads );
+        pthread_mutex_destroy( &state.lock );
+        return;
+    }
+#endif
+    for( int64_t i = 0; i < nItems; i++ )
+        func( arg, i );
+}
+
+static const uint32_t _crc32cTable[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+    0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+    0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+    0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+    0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+    0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+    0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+    0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+    0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+    0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+    0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+    0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+    0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+    0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+    0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+    0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+    0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+    0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+    0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+    0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+    0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+    0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+
+};
+
+#if defined(MRCZ_HAVE_CRC32C_HW)
+__attribute__((target("sse4.2")))
+static uint32_t _crc32cHardware( uint32_t crc, const uint8_t *buf, size_t len )
+{
+    while( len > 0 && ((uintptr_t)buf & 7) )
+    {
+        crc = _mm_crc32_u8( crc, *buf++ );
+        len--;
+    }
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for( ; len >= 8; len -= 8, buf += 8 )
+        crc64 = _mm_crc32_u64( crc64, *(const uint64_t*)buf );
+    crc = (uint32_t)crc64;
+#endif
+    for( ; len >= 4; len -= 4, buf += 4 )
+        crc = _mm_crc32_u32( crc, *(const uint32_t*)buf );
+    while( len-- > 0 )
+        crc = _mm_crc32_u8( crc, *buf++ );
+    return crc;
+}
+#endif
+
+uint32_t _crc32c( uint32_t crc, const void *buf, size_t len )
+{   // CRC32C (Castagnoli), as used by iSCSI/ext4.  Uses the SSE4.2 crc32 
+    // instruction if the CPU has it, otherwise a byte-wise table.
+    const uint8_t *bytes = (const uint8_t*)buf;
+    crc = ~crc;
+#if defined(MRCZ_HAVE_CRC32C_HW)
+    if( __builtin_cpu_supports( "sse4.2" ) )
+        return ~_crc32cHardware( crc, bytes, len );
+#endif
+    while( len-- > 0 )
+        crc = _crc32cTable[(crc ^ *bytes++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+int _hostIsBigEndian( void )
+{
+    const uint16_t one = 1;
+    return *(const uint8_t*)&one == 0;
+}
+
+size_t _swapWidth( mrcHeader *header )
+{   // Word size to byte-swap the data by, or 0 if the file is in host order.  
+    // Complex values are pairs of 4-byte floats.
+    uint8_t host = _hostIsBigEndian() ? MRCZ_STAMP_BIG : MRCZ_STAMP_LITTLE;
+    if( header->endian[0] != MRCZ_STAMP_LITTLE && header->endian[0] != MRCZ_STAMP_BIG )
+        return 0;
+    if( header->endian[0] == host )
+        return 0;
+    return header->mrcType == MRC_COMPLEX64 ? sizeof(float) : mrcHeader_itemsize( header );
+}
+
+void _byteSwap( uint8_t *data, size_t nbytes, size_t width )
+{   // Reverse the byte order of each width-byte word of data, in place.
+    size_t i = 0;
+    uint8_t t;
+
+    if( width == 2 )
+    {
+#if defined(MRCZ_HAVE_SSE2)
+        for( ; i + 16 <= nbytes; i += 16 )
+        {
+            __m128i v = _mm_loadu_si128( (__m128i*)&data[i] );
+            v = _mm_or_si128( _mm_slli_epi16( v, 8 ), _mm_srli_epi16( v, 8 ) );
+            _mm_storeu_si128( (__m128i*)&data[i], v );
+        }
+#endif
+        for( ; i + 2 <= nbytes; i += 2 )
+        {
+            t = data[i]; data[i] = data[i+1]; data[i+1] = t;
+        }
+    }
+    else if( width == 4 )
+    {
+#if defined(MRCZ_HAVE_SSE2)
+        for( ; i + 16 <= nbytes; i += 16 )
+        {   // Swap the 16-bit halves, then the bytes within each half
+            __m128i v = _mm_loadu_si128( (__m128i*)&data[i] );
+            v = _mm_shufflehi_epi16( _mm_shufflelo_epi16( v, 0xB1 ), 0xB1 );
+            v = _mm_or_si128( _mm_slli_epi16( v, 8 ), _mm_srli_epi16( v, 8 ) );
+            _mm_storeu_si128( (__m128i*)&data[i], v );
+        }
+#endif
+        for( ; i + 4 <= nbytes; i += 4 )
+        {
+            t = data[i]; data[i] = data[i+3]; data[i+3] = t;
+            t = data[i+1]; data[i+1] = data[i+2]; data[i+2] = t;
+        }
+    }
+    else if( width > 1 )
+    {
+        for( ; i + width <= nbytes; i += width )
+        {
+            for( size_t b = 0; b < width/2; b++ )
+            {
+                t = data[i+b]; data[i+b] = data[i+width-1-b]; data[i+width-1-b] = t;
+            }
+        }
+    }
+}
+
+static int _plausibleHeader( const uint8_t *words )
+{   // Whether the first four header words look like dimensions and a mode
+    int32_t w[4];
+    memcpy( w, words, sizeof(w) );
+    for( int i = 0; i < 3; i++ )
+    {
+        if( w[i] < 0 || w[i] >= (1 << 20) )
+            return 0;
+    }
+    return w[3] >= 0 && w[3] % MRC_COMP_RATIO <= MRC_UINT16 && w[3] / MRC_COMP_RATIO <= BLOSC_COMPRESSOR_ZSTD;
+}
+
+int _parseStandardHeader( uint8_t *rawBytes, mrcHeader* header, char *metaname )
 {
+    uint8_t headerBytes[MRC_HEADER_LEN];
+    int swap;
+
     // Start 
     header->metaname = metaname;
+    memcpy( headerBytes, rawBytes, MRC_HEADER_LEN );
+
+    // The machine stamp gives the byte order.  Old files may have no stamp, in 
+    // which case dimensions and mode that only make sense byte-swapped give 
+    // it away.
+    if( headerBytes[212] == MRCZ_STAMP_LITTLE || headerBytes[212] == MRCZ_STAMP_BIG )
+    {
+        swap = headerBytes[212] != (_hostIsBigEndian() ? MRCZ_STAMP_BIG : MRCZ_STAMP_LITTLE);
+    }
+    else
+    {
+        uint8_t swapped[16];
+        memcpy( swapped, headerBytes, sizeof(swapped) );
+        _byteSwap( swapped, sizeof(swapped), 4 );
+        swap = !_plausibleHeader( headerBytes ) && _plausibleHeader( swapped );
+    }
+    header->endian[0] = header->endian[1] = (swap != _hostIsBigEndian()) ? MRCZ_STAMP_BIG : MRCZ_STAMP_LITTLE;
+    if( swap )
+    {   // All numeric fields up to the labels are 4-byte words
+        _byteSwap( headerBytes, 212, 4 );
+        _byteSwap( &headerBytes[216], 8, 4 );
+    }
 
     memcpy( &header->dimensions, &headerBytes[0], sizeof(header->dimensions) );
     memcpy( &header->mrcType, &headerBytes[12], sizeof(header->mrcType) );
@@ -216,13 +650,32 @@ int _parseStandardHeader( uint8_t *headerBytes, mrcHeader* header, char *metanam
 
     // MRC2000 fields
     memcpy( &header->origin, &headerBytes[196], sizeof(header->origin) );
-    memcpy( &header->endian, &headerBytes[212], sizeof(header->endian) );
     memcpy( &header->std, &headerBytes[216], sizeof(header->std) );
 
     // MRCZ fields
     memcpy( &header->voltage, &headerBytes[132], sizeof(header->voltage) );
     memcpy( &header->C3, &headerBytes[136], sizeof(header->C3) );
     memcpy( &header->gain, &headerBytes[140], sizeof(header->gain) );
+    memcpy( &header->mrczFlags, &headerBytes[144], sizeof(header->mrczFlags) );
+    memcpy( &header->keyframeInterval, &headerBytes[148], sizeof(header->keyframeInterval) );
+    header->mantissaBits = 0;
+    header->absoluteError = 0.0f;
+    if( header->mrczFlags & MRCZ_FLAG_LOSSY )
+    {   // Other MRC files may have anything in these bytes
+        memcpy( &header->mantissaBits, &headerBytes[120], sizeof(header->mantissaBits) );
+        memcpy( &header->absoluteError, &headerBytes[124], sizeof(header->absoluteError) );
+    }
+    header->quantScale = 0.0f;
+    header->quantOffset = 0.0f;
+    if( header->mrczFlags & MRCZ_FLAG_QUANTIZED )
+    {
+        memcpy( &header->quantScale, &headerBytes[112], sizeof(header->quantScale) );
+        memcpy( &header->quantOffset, &headerBytes[116], sizeof(header->quantOffset) );
+    }
+    if( (header->mrczFlags & MRCZ_FLAG_DICTIONARY) && memcmp( &headerBytes[104], MRCZ_DICTIONARY_EXTTYP, 4 ) != 0 )
+    {   // The extended header is not a dictionary after all
+        header->mrczFlags &= ~MRCZ_FLAG_DICTIONARY;
+    }
            
     // CMake defines NDEBUG for _no_ debugging
 #ifndef NDEBUG 
@@ -237,10 +690,45 @@ int _parseStandardHeader( uint8_t *headerBytes, mrcHeader* header, char *metanam
     return 0;
 }
 
-uint8_t* _buildStandardHeader( FILE *fh, mrcHeader *header )
-{
-    static uint8_t headerBytes[MRC_HEADER_LEN];
+void _buildStandardHeader( mrcHeader *header, uint8_t *headerBytes )
+{   // Fill headerBytes[MRC_HEADER_LEN], which must be zeroed, from header
     int32_t mrcMetaType = header->mrcType + MRC_COMP_RATIO*header->blosc_compressor;
+    uint32_t mrczFlags = header->mrczFlags;
+    int32_t keyframeInterval = 0;
+
+    if( header->blosc_compressor == BLOSC_COMPRESSOR_NONE )
+    {   // Chunk-level features have no meaning for uncompressed data
+        mrczFlags &= ~MRCZ_CHUNK_FLAGS;
+    }
+    if( header->mrcType != MRC_COMPLEX64 )
+        mrczFlags &= ~MRCZ_FLAG_SPLITCOMPLEX;
+    if( mrczFlags & MRCZ_FLAG_DELTA )
+        keyframeInterval = _keyframeInterval( header );
+    if( _isLossy( header ) )
+    {
+        mrczFlags |= MRCZ_FLAG_LOSSY;
+        if( header->mantissaBits > 0 && header->mantissaBits < 23 )
+            memcpy( &headerBytes[120], &header->mantissaBits, sizeof(header->mantissaBits) );
+        if( header->absoluteError > 0.0f )
+            memcpy( &headerBytes[124], &header->absoluteError, sizeof(header->absoluteError) );
+    }
+    else
+    {
+        mrczFlags &= ~MRCZ_FLAG_LOSSY;
+    }
+    if( (mrczFlags & MRCZ_FLAG_QUANTIZED) && header->mrcType != MRC_FLOAT32 && header->mrcType != MRC_COMPLEX64 )
+    {
+        memcpy( &headerBytes[112], &header->quantScale, sizeof(header->quantScale) );
+        memcpy( &headerBytes[116], &header->quantOffset, sizeof(header->quantOffset) );
+    }
+    else
+    {
+        mrczFlags &= ~MRCZ_FLAG_QUANTIZED;
+    }
+    if( _hasDictionary( header ) )
+        memcpy( &headerBytes[104], MRCZ_DICTIONARY_EXTTYP, 4 );
+    else
+        mrczFlags &= ~MRCZ_FLAG_DICTIONARY;
     
     memcpy( &headerBytes[0], &header->dimensions, sizeof(header->dimensions) );
     memcpy( &headerBytes[12], &mrcMetaType, sizeof(mrcMetaType) );
@@ -260,14 +748,16 @@ uint8_t* _buildStandardHeader( FILE *fh, mrcHeader *header )
 
     // MRC2000 fields
     memcpy( &headerBytes[196], &header->origin, sizeof(header->origin) );
-    memcpy( &headerBytes[212], &header->endian, sizeof(header->endian) );
+    // Always written in host order
+    headerBytes[212] = headerBytes[213] = _hostIsBigEndian() ? MRCZ_STAMP_BIG : MRCZ_STAMP_LITTLE;
     memcpy( &headerBytes[216], &header->std, sizeof(header->std) );
 
     // MRCZ2016 fields
     memcpy( &headerBytes[132], &header->voltage, sizeof(header->voltage) );
     memcpy( &headerBytes[136], &header->C3, sizeof(header->C3) );    
     memcpy( &headerBytes[140], &header->gain, sizeof(header->gain) );
-    return headerBytes;
+    memcpy( &headerBytes[144], &mrczFlags, sizeof(mrczFlags) );
+    memcpy( &headerBytes[148], &keyframeInterval, sizeof(keyframeInterval) );
 }
 
 int _loadUncompressedMRC( FILE *fh, mrcVolume *dest )
@@ -279,40 +769,25 @@ int _loadUncompressedMRC( FILE *fh, mrcVolume *dest )
     size_t dz = dest->header->dimensions[2];
     size_t dsize = dx*dy*dz;
     int fread_ret = 0;
+    uint8_t *bytesRepr = _mrcVolume_alloc( dest, dsize * mrcHeader_itemsize( dest->header ) );
 
-
-    switch( dest->header->mrcType )
-    {  // Initialize the data union in mrcVolume dest
-        
-        case MRC_INT8:
-            dest->_i1 = malloc( dsize * sizeof(int8_t) );
-            fread_ret = fread( dest->_i1, sizeof(int8_t), dsize, fh );
-            break;
-        case MRC_INT16:
-            dest->_i2 = malloc( dsize * sizeof(int16_t) );
-            fread_ret = fread( dest->_i2, sizeof(int16_t), dsize, fh );
-            break;
-        case MRC_FLOAT32:
-            dest->_f4 = malloc( dsize * sizeof(float) );
+    if( bytesRepr == NULL )
+    {
+        printf( "Error: _loadUncompressedMRC could not allocate memory for mrcType %d\n", dest->header->mrcType );
+        return 0;
+    }
 #ifndef NDEBUG
-            printf( "_loadUncompressedMRC: Trying to read %lu floats corresponding to %lu bytes\n", dsize, dsize*sizeof(float) );
-#endif
-            fread_ret = fread( dest->_f4, sizeof(float), dsize, fh );
-            break;
-            
-        case MRC_COMPLEX64:
-#if defined(_WIN32) && !defined(__MINGW32__)
-			dest->_c8 = malloc(dsize * sizeof(_Fcomplex));
-			fread_ret = fread(dest->_c8, sizeof(_Fcomplex), dsize, fh);
-#else
-			dest->_c8 = malloc(dsize * sizeof(float complex));
-			fread_ret = fread(dest->_c8, sizeof(float complex), dsize, fh);
+    printf( "_loadUncompressedMRC: Trying to read %lu items of %lu bytes\n", dsize, mrcHeader_itemsize( dest->header ) );
 #endif
-            break;
-        case MRC_UINT16:
-            dest->_u2 = malloc( dsize * sizeof(uint16_t) );
-            fread_ret = fread( dest->_u2, sizeof(uint16_t), dsize, fh );
-            break;
+    fread_ret = fread( bytesRepr, mrcHeader_itemsize( dest->header ), dsize, fh );
+    _byteSwap( bytesRepr, (size_t)fread_ret * mrcHeader_itemsize( dest->header ), _swapWidth( dest->header ) );
+    if( dest->header->histogram != NULL )
+    {   // One read, so a separate pass, slice by slice
+        _histogramStart( dest->header->histogram, dest->header );
+        for( size_t k = 0; k < dz; k++ )
+            _histogramSlice( dest->header->histogram->keys, dest->header->mrcType, 
+                             &bytesRepr[k * dx * dy * mrcHeader_itemsize( dest->header )], dx * dy );
+        _histogramFinish( dest->header->histogram );
     }
     
 #ifndef NDEBUG
@@ -324,275 +799,4671 @@ int _loadUncompressedMRC( FILE *fh, mrcVolume *dest )
     return fread_ret;
 }
 
-int _decompressMRCZ( FILE *fh, mrcVolume *dest )
-{
-    // fh must point to the start of the first blsoc1 (32-byte) header
-    int blosc_ret, fread_ret;
-    size_t dx = dest->header->dimensions[0]; 
-    size_t dy = dest->header->dimensions[1];                                
-    size_t dz = dest->header->dimensions[2];
-    size_t dsize = dx * dy * dz;
-    size_t tell_pos;
-    size_t itemsize;
-    uint8_t *bytesRepr;
-    uint8_t *bloscRepr;
-
-    int32_t blosc_header[4];
-
-    if( dest->header->blosc_threads <= 0 )
-    {   // We should not get here if we used the mrcHeader_new factory, but a 
-        // user might.
-        printf( "Warning: blosc_threads set to %d, defaulting to %d.\n", 
-               dest->header->blosc_threads, BLOSC_DEFAULT_THREADS );
-        dest->header->blosc_threads = BLOSC_DEFAULT_THREADS;
-    }
-    blosc_set_nthreads( dest->header->blosc_threads );
-
-    switch( dest->header->mrcType )
-    {  // Initialize the data union in mrcVolume dest
-        
-        case MRC_INT8:
-            dest->_i1 = malloc( dsize * sizeof(int8_t) );
-            itemsize = 1;
-            bytesRepr = (uint8_t*)dest->_i1;
-            break;
-        case MRC_INT16:
-            dest->_i2 = malloc( dsize * sizeof(int16_t) );
-            itemsize = 2;
-            bytesRepr = (uint8_t*)dest->_i2;
-            break;
-        case MRC_FLOAT32:
-            dest->_f4 = malloc( dsize * sizeof(float) );
-            itemsize = 4;
-            bytesRepr = (uint8_t*)dest->_f4;
-            break;
-        case MRC_COMPLEX64:
-#if defined(_WIN32) && !defined(__MINGW32__)
-			dest->_c8 = malloc(dsize * sizeof(_Fcomplex));
-#else
-			dest->_c8 = malloc(dsize * sizeof(float complex));
-#endif   
-            itemsize = 8;
-            bytesRepr = (uint8_t*)dest->_c8;    
-            break;
-        case MRC_UINT16:
-            dest->_u2 = malloc( dsize * sizeof(uint16_t) );
-            itemsize = 2;
-            bytesRepr = (uint8_t*)dest->_u2;  
-            break;
-    }
-
-    blosc_init();
-    // Iterate through each z-axis slice as a chunk and decompress 
-    // each one.
-    for( uint32_t k = 0; k < dz; k++ )
-    {
-        // Blosc header format:
-        // https://github.com/Blosc/c-blosc/blob/master/README_HEADER.rst
-        tell_pos = ftell( fh );
-        fread_ret = fread( blosc_header, sizeof(blosc_header), 1, fh ); 
-        fseek( fh, tell_pos, SEEK_SET );
+int _readChunk( FILE *fh, uint8_t **bloscRepr, size_t *capacity )
+{   // Read one blosc chunk from fh into *bloscRepr, growing it as needed.  The 
+    // chunk size is taken from the 16-byte blosc header without seeking, see:
+    // https://github.com/Blosc/c-blosc/blob/master/README_HEADER.rst
+    // Returns the size of the chunk in bytes, or -1 on a short or corrupt read.
+    uint8_t bloscHeader[BLOSC_MIN_HEADER_LENGTH];
+    uint32_t nbytes, cbytes;
 
+    if( fread( bloscHeader, sizeof(uint8_t), BLOSC_MIN_HEADER_LENGTH, fh ) != BLOSC_MIN_HEADER_LENGTH )
+        return -1;
+    memcpy( &nbytes, &bloscHeader[4], sizeof(nbytes) );
+    memcpy( &cbytes, &bloscHeader[12], sizeof(cbytes) );
 #ifndef NDEBUG
-        printf( "_decompressMRCZ: blosc_header: flags: %d, nbytes: %d, blocksize: %d, cbytes: %d\n", blosc_header[0], blosc_header[1], blosc_header[2], blosc_header[3]);
+    printf( "_readChunk: blosc_header: flags: %d, nbytes: %u, cbytes: %u\n", bloscHeader[2], nbytes, cbytes );
 #endif
-        bloscRepr = malloc( blosc_header[3] );
-        fread_ret = fread( bloscRepr, sizeof(uint8_t), blosc_header[3], fh );
-        blosc_ret = blosc_decompress_ctx( (void *)bloscRepr, 
-                                         (void *)&bytesRepr[itemsize*k*dx*dy], 
-                                         itemsize*dx*dy, dest->header->blosc_threads );
-                                         
+    if( cbytes < BLOSC_MIN_HEADER_LENGTH || cbytes > (uint64_t)nbytes + BLOSC_MAX_OVERHEAD || cbytes > INT_MAX )
+        return -1;
 
+    if( *capacity < cbytes )
+    {
+        free( *bloscRepr );
+        *bloscRepr = malloc( cbytes );
+        *capacity = cbytes;
     }
-    blosc_destroy();
-    return blosc_ret;
+    memcpy( *bloscRepr, bloscHeader, BLOSC_MIN_HEADER_LENGTH );
+    if( fread( &(*bloscRepr)[BLOSC_MIN_HEADER_LENGTH], sizeof(uint8_t), cbytes - BLOSC_MIN_HEADER_LENGTH, fh ) 
+            != cbytes - BLOSC_MIN_HEADER_LENGTH )
+        return -1;
+    return (int)cbytes;
 }
 
-int _compressMRCZ( FILE *fh, mrcVolume *source )
-{
-    int blosc_ret, fwrite_ret;
-    mrcHeader *header = source->header;
-    size_t dx = header->dimensions[0]; 
-    size_t dy = header->dimensions[1];                                
-    size_t dz = header->dimensions[2];
-    size_t itemsize = mrcVolume_itemsize(source);
-    const char *compressor_str;
-
-    int32_t blosc_cbytes = itemsize*dx*dy; // Maximum size of slice in compressed bytes
-    
-    // Do we have to malloc this as the size of an uncompressed slice?
-    uint8_t *bloscRepr = malloc( itemsize*dx*dy ); 
-    uint8_t *bytesRepr = (uint8_t*)mrcVolume_data(source);
+int _writeTrailer( FILE *fh, int64_t trailerStart, mrczChunkEntry *entries, uint32_t nChunks, 
+                   mrczPyramid *pyramid )
+{   // Write the chunk index section (if entries), the pyramid section (if 
+    // pyramid) and the trailer tail at the current position of fh, which must 
+    // be trailerStart (the end of the last chunk).
+    mrczSection section;
+    uint8_t tail[MRCZ_TRAILER_TAIL_LEN];
+    int32_t nSections = 0;
+    int64_t pos = trailerStart;
 
-    // Can this switch be macroed?
-    switch(source->header->blosc_compressor)
+    if( entries != NULL )
     {
-        case(BLOSC_COMRPRESSOR_BLOSCLZ):
-            compressor_str = (const char*)BLOSC_BLOSCLZ_COMPNAME;
-            break;
-        case(BLOSC_COMPRESSOR_LZ4):
-            compressor_str = (const char*)BLOSC_LZ4_COMPNAME;
-            break;
-        case(BLOSC_COMPRESSOR_LZ4HC):
-            compressor_str = (const char*)BLOSC_LZ4HC_COMPNAME;
-            break;
-        case(BLOSC_COMPRESSOR_SNAPPY):
-            compressor_str = (const char*)BLOSC_SNAPPY_COMPNAME;
-            break;
-        case(BLOSC_COMPRESSOR_ZLIB):
-            compressor_str = (const char*)BLOSC_ZLIB_COMPNAME;
-            break;
-        case(BLOSC_COMPRESSOR_ZSTD):
-            compressor_str = (const char*)BLOSC_ZSTD_COMPNAME;
-            break;
+        memcpy( section.tag, MRCZ_SECTION_CHUNKINDEX, sizeof(section.tag) );
+        section.count = nChunks;
+        section.bytes = (uint64_t)nChunks * sizeof(mrczChunkEntry);
+        if( fwrite( &section, sizeof(section), 1, fh ) != 1 
+            || fwrite( entries, sizeof(mrczChunkEntry), nChunks, fh ) != nChunks )
+        {
+            printf( "Error: _writeTrailer failed to write the chunk index\n" );
+            return -1;
+        }
+        nSections++;
+        pos += sizeof(section) + section.bytes;
     }
-    
-#ifndef NDEBUG
-    printf( "_compressMRCZ: compressor_str: %s, clevel: %d, filter: %d, blocksize: %lu, threads: %d\n", 
-           compressor_str, header->blosc_clevel, header->blosc_filter, header->blosc_blocksize, header->blosc_threads);
-#endif
-
-    blosc_init();
-    for( uint32_t k = 0; k < dz; k++ )
+    if( pyramid != NULL )
     {
-        blosc_ret = blosc_compress_ctx( header->blosc_clevel, 
-                                        header->blosc_filter, 
-                                        itemsize, 
-                                        itemsize*dx*dy, 
-                                        (void*) &bytesRepr[itemsize*k*dx*dy], 
-                                        bloscRepr, 
-                                        blosc_cbytes, 
-                                        compressor_str, 
-                                        header->blosc_blocksize, 
-                                        header->blosc_threads );
-        if( blosc_ret == -1 ) 
-        { 
-            printf( "Error: " );
-            return blosc_ret; 
-        }
-
-        fwrite_ret = fwrite( bloscRepr, sizeof(uint8_t), blosc_ret, fh);
-        if( fwrite_ret <= 0 )
+        if( _mrczPyramid_write( pyramid, fh, pos ) != 0 )
         {
-            printf( "Error: _compressMRCZ wrote %d bytes", fwrite_ret );
+            printf( "Error: _writeTrailer failed to write the pyramid\n" );
+            return -1;
         }
-#ifndef NDEBUG        
-        printf( "_compressMRCZ: from %lu to %d bytes, and write: %d bytes\n", itemsize*dx*dy, blosc_ret, fwrite_ret );
-#endif
+        nSections++;
     }
-    blosc_destroy();
 
-    return blosc_ret;
+    memcpy( &tail[0], &trailerStart, sizeof(trailerStart) );
+    memcpy( &tail[8], &nSections, sizeof(nSections) );
+    memcpy( &tail[12], MRCZ_TRAILER_MAGIC, 4 );
+    if( fwrite( tail, sizeof(uint8_t), MRCZ_TRAILER_TAIL_LEN, fh ) != MRCZ_TRAILER_TAIL_LEN )
+    {
+        printf( "Error: _writeTrailer failed to write the trailer\n" );
+        return -1;
+    }
+    return 0;
 }
 
+int _findSection( FILE *fh, const char *tag, mrczSection *section )
+{   // Look up a trailer section by tag and leave fh at the start of its 
+    // payload.  Returns 0 if found, or -1 if the file has no such section.
+    uint8_t tail[MRCZ_TRAILER_TAIL_LEN];
+    int64_t trailerStart;
+    int32_t nSections;
 
+    if( fseek( fh, -MRCZ_TRAILER_TAIL_LEN, SEEK_END ) != 0
+        || fread( tail, sizeof(uint8_t), MRCZ_TRAILER_TAIL_LEN, fh ) != MRCZ_TRAILER_TAIL_LEN
+        || memcmp( &tail[12], MRCZ_TRAILER_MAGIC, 4 ) != 0 )
+        return -1;
+    memcpy( &trailerStart, &tail[0], sizeof(trailerStart) );
+    memcpy( &nSections, &tail[8], sizeof(nSections) );
+    fseek( fh, trailerStart, SEEK_SET );
+    for( int32_t i = 0; i < nSections; i++ )
+    {
+        if( fread( section, sizeof(*section), 1, fh ) != 1 )
+            return -1;
+        if( memcmp( section->tag, tag, sizeof(section->tag) ) == 0 )
+            return 0;
+        fseek( fh, section->bytes, SEEK_CUR );
+    }
+    return -1;
+}
+
+int _truncateFile( FILE *fh )
+{   // Cut the file off at the current position, so that no stale trailer is 
+    // left behind after rewriting the end of a file.
+    long pos;
+    fflush( fh );
+    pos = ftell( fh );
+#if defined(_WIN32)
+    return _chsize( _fileno( fh ), pos );
+#else
+    return ftruncate( fileno( fh ), pos );
+#endif
+}
+
+int _checkChunkIndex( FILE *fh, uint32_t *crcs, uint32_t nChunks, char *filename )
+{   // fh must point to the start of the trailer (just past the last chunk).  
+    // Compares the checksums of the chunks as read, crcs, against the chunk 
+    // index and returns the number of mismatched chunks, or -1 if the index 
+    // is missing or truncated.
+    mrczSection section;
+    mrczChunkEntry *entries;
+    int nBad = 0;
+
+    if( fread( &section, sizeof(section), 1, fh ) != 1 
+        || memcmp( section.tag, MRCZ_SECTION_CHUNKINDEX, sizeof(section.tag) ) != 0
+        || section.count != nChunks )
+    {
+        printf( "Error: %s has no valid chunk index\n", filename );
+        return -1;
+    }
+    entries = malloc( nChunks * sizeof(mrczChunkEntry) );
+    if( fread( entries, sizeof(mrczChunkEntry), nChunks, fh ) != nChunks )
+    {
+        printf( "Error: chunk index of %s is truncated\n", filename );
+        free( entries );
+        return -1;
+    }
+    for( uint32_t k = 0; k < nChunks; k++ )
+    {
+        if( entries[k].crc32c != crcs[k] )
+        {
+            printf( "Error: %s slice %u checksum mismatch (stored %08x, read %08x)\n", 
+                    filename, k, entries[k].crc32c, crcs[k] );
+            nBad++;
+        }
+    }
+    free( entries );
+    return nBad;
+}
+
+void _splitComplex( const float *src, float *dest, size_t n )
+{   // De-interleave n complex64 values into a plane of the real parts followed 
+    // by a plane of the imaginary parts, so that bit-shuffle sees like with like.
+    float *re = dest, *im = &dest[n];
+    size_t i = 0;
+#if defined(MRCZ_HAVE_SSE2)
+    for( ; i + 4 <= n; i += 4 )
+    {
+        __m128 a = _mm_loadu_ps( &src[2*i] );    // r0 i0 r1 i1
+        __m128 b = _mm_loadu_ps( &src[2*i+4] );  // r2 i2 r3 i3
+        _mm_storeu_ps( &re[i], _mm_shuffle_ps( a, b, _MM_SHUFFLE(2,0,2,0) ) );
+        _mm_storeu_ps( &im[i], _mm_shuffle_ps( a, b, _MM_SHUFFLE(3,1,3,1) ) );
+    }
+#endif
+    for( ; i < n; i++ )
+    {
+        re[i] = src[2*i];
+        im[i] = src[2*i+1];
+    }
+}
+
+void _mergeComplex( const float *src, float *dest, size_t n )
+{   // Inverse of _splitComplex
+    const float *re = src, *im = &src[n];
+    size_t i = 0;
+#if defined(MRCZ_HAVE_SSE2)
+    for( ; i + 4 <= n; i += 4 )
+    {
+        __m128 r = _mm_loadu_ps( &re[i] );
+        __m128 j = _mm_loadu_ps( &im[i] );
+        _mm_storeu_ps( &dest[2*i], _mm_unpacklo_ps( r, j ) );
+        _mm_storeu_ps( &dest[2*i+4], _mm_unpackhi_ps( r, j ) );
+    }
+#endif
+    for( ; i < n; i++ )
+    {
+        dest[2*i] = re[i];
+        dest[2*i+1] = im[i];
+    }
+}
+
+size_t _filteredItemsize( mrcHeader *header )
+{   // Size of the items handed to blosc, after splitting complex planes
+    if( header->mrcType == MRC_COMPLEX64 && (header->mrczFlags & MRCZ_FLAG_SPLITCOMPLEX) )
+        return sizeof(float);
+    return mrcHeader_itemsize( header );
+}
+
+int32_t _keyframeInterval( mrcHeader *header )
+{
+    return header->keyframeInterval > 0 ? header->keyframeInterval : MRCZ_DEFAULT_KEYFRAMES;
+}
+
+int _quantizeRange( int32_t mrcType, float *lo, float *hi )
+{   // Range of the integer type that float data is quantized to, or -1
+    switch( mrcType )
+    {
+        case MRC_INT8:   *lo = -128.0f; *hi = 127.0f; return 0;
+        case MRC_INT16:  *lo = -32768.0f; *hi = 32767.0f; return 0;
+        case MRC_UINT16: *lo = 0.0f; *hi = 65535.0f; return 0;
+    }
+    return -1;
+}
+
+int _chooseQuantization( mrcHeader *header, double min, double max )
+{   // Set header->quantScale and quantOffset so that [min, max] spans the 
+    // range of header->mrcType.  Returns 0, or -1 for a non-integer type.
+    float lo, hi;
+    if( _quantizeRange( header->mrcType, &lo, &hi ) != 0 )
+        return -1;
+    header->quantScale = max > min ? (float)((max - min) / (hi - lo)) : 1.0f;
+    header->quantOffset = (float)(min - lo * header->quantScale);
+    return 0;
+}
+
+void _quantizeFloats( const float *src, void *dest, size_t n, int32_t mrcType, float scale, float offset )
+{   // dest = round( (src - offset) / scale ), saturated to the integer type.  
+    // NaNs become the lowest value.
+    float lo, hi, inv = 1.0f / scale;
+    size_t i = 0;
+
+    if( _quantizeRange( mrcType, &lo, &hi ) != 0 )
+        return;
+#if defined(MRCZ_HAVE_SSE2)
+    {
+        const __m128 offv = _mm_set1_ps( offset ), invv = _mm_set1_ps( inv );
+        const __m128 lov = _mm_set1_ps( lo ), hiv = _mm_set1_ps( hi );
+        const __m128i bias = _mm_set1_epi32( 32768 ), flip = _mm_set1_epi16( (short)0x8000 );
+#define _QUANTIZE4( j )  _mm_cvtps_epi32( _mm_min_ps( _mm_max_ps( _mm_mul_ps( \
+            _mm_sub_ps( _mm_loadu_ps( &src[i + (j)] ), offv ), invv ), lov ), hiv ) )
+        if( mrcType == MRC_INT8 )
+        {
+            for( ; i + 16 <= n; i += 16 )
+            {
+                __m128i a = _mm_packs_epi32( _QUANTIZE4( 0 ), _QUANTIZE4( 4 ) );
+                __m128i b = _mm_packs_epi32( _QUANTIZE4( 8 ), _QUANTIZE4( 12 ) );
+                _mm_storeu_si128( (__m128i*)&((int8_t*)dest)[i], _mm_packs_epi16( a, b ) );
+            }
+        }
+        else if( mrcType == MRC_INT16 )
+        {
+            for( ; i + 8 <= n; i += 8 )
+                _mm_storeu_si128( (__m128i*)&((int16_t*)dest)[i], _mm_packs_epi32( _QUANTIZE4( 0 ), _QUANTIZE4( 4 ) ) );
+        }
+        else
+        {   // No unsigned pack in SSE2, so shift into the signed range and back
+            for( ; i + 8 <= n; i += 8 )
+            {
+                __m128i a = _mm_sub_epi32( _QUANTIZE4( 0 ), bias ), b = _mm_sub_epi32( _QUANTIZE4( 4 ), bias );
+                _mm_storeu_si128( (__m128i*)&((uint16_t*)dest)[i], _mm_xor_si128( _mm_packs_epi32( a, b ), flip ) );
+            }
+        }
+#undef _QUANTIZE4
+    }
+#endif
+    for( ; i < n; i++ )
+    {
+        float v = (src[i] - offset) * inv;
+        long q;
+        v = v > lo ? v : lo;
+        v = v < hi ? v : hi;
+        q = lrintf( v );
+        switch( mrcType )
+        {
+            case MRC_INT8:   ((int8_t*)dest)[i] = (int8_t)q; break;
+            case MRC_INT16:  ((int16_t*)dest)[i] = (int16_t)q; break;
+            case MRC_UINT16: ((uint16_t*)dest)[i] = (uint16_t)q; break;
+        }
+    }
+}
+
+int _quantizedHeader( mrcHeader *header, mrcHeader *stored, double min, double max )
+{   // stored = header for float32 data quantized to header->quantizedType, with 
+    // the scale and offset chosen from [min, max] unless quantScale is set.  
+    // min and max become the statistics in stored units.  Returns 0 or -1.
+    memcpy( stored, header, sizeof(*stored) );
+    stored->mrcType = header->quantizedType;
+    stored->mrczFlags |= MRCZ_FLAG_QUANTIZED;
+    if( (header->quantScale == 0.0f && _chooseQuantization( stored, min, max ) != 0) 
+        || stored->quantScale == 0.0f )
+    {
+        printf( "Error: cannot quantize float32 data to mrcType %d\n", header->quantizedType );
+        return -1;
+    }
+    stored->min = (float)((min - stored->quantOffset) / stored->quantScale);
+    stored->max = (float)((max - stored->quantOffset) / stored->quantScale);
+    stored->mean = (header->mean - stored->quantOffset) / stored->quantScale;
+    stored->std = header->std / fabsf( stored->quantScale );
+    return 0;
+}
+
+int _dequantizeVolume( mrcVolume *vol )
+{   // Replace the quantized integer data of vol with float32.  The header 
+    // keeps MRCZ_FLAG_QUANTIZED, with quantizedType set so that writing the 
+    // volume quantizes it the same way again.  Returns 0 or -1.
+    mrcHeader *header = vol->header;
+    size_t n = (size_t)header->dimensions[0] * header->dimensions[1] * header->dimensions[2];
+    void (*freeData)( void*, void* ) = vol->allocator.free != NULL ? vol->allocator.free : _alignedFree;
+    void *ints = mrcVolume_data( vol );
+    float lo, hi;
+    float *floats;
+
+    if( !(header->mrczFlags & MRCZ_FLAG_QUANTIZED) || _quantizeRange( header->mrcType, &lo, &hi ) != 0 )
+        return 0;
+    header->quantizedType = header->mrcType;
+    header->mrcType = MRC_FLOAT32;
+    floats = (float*)_mrcVolume_alloc( vol, n * sizeof(float) );
+    if( floats == NULL )
+    {
+        header->mrcType = header->quantizedType;
+        printf( "Error: could not allocate memory to dequantize %s\n", header->metaname );
+        return -1;
+    }
+    _dequantize( ints, floats, n, header->quantizedType, header->quantScale, header->quantOffset );
+    freeData( ints, vol->allocator.opaque );
+    vol->_i1 = NULL;
+    vol->_i2 = NULL;
+    vol->_u2 = NULL;
+
+    header->min = header->min * header->quantScale + header->quantOffset;
+    header->max = header->max * header->quantScale + header->quantOffset;
+    header->mean = header->mean * header->quantScale + header->quantOffset;
+    header->std = header->std * fabsf( header->quantScale );
+    if( header->quantScale < 0.0f )
+    {
+        float swap = header->min;
+        header->min = header->max;
+        header->max = swap;
+    }
+    return 0;
+}
+
+void _dequantize( const void *src, float *dest, size_t n, int32_t mrcType, float scale, float offset )
+{   // dest = src * scale + offset
+    switch( mrcType )
+    {
+        case MRC_INT8:
+            for( size_t i = 0; i < n; i++ )
+                dest[i] = ((const int8_t*)src)[i] * scale + offset;
+            break;
+        case MRC_INT16:
+            for( size_t i = 0; i < n; i++ )
+                dest[i] = ((const int16_t*)src)[i] * scale + offset;
+            break;
+        case MRC_UINT16:
+            for( size_t i = 0; i < n; i++ )
+                dest[i] = ((const uint16_t*)src)[i] * scale + offset;
+            break;
+    }
+}
+
+int _floatsAreIntegers( const float *src, size_t n, double *min, double *max )
+{   // Whether all n floats are whole numbers that survive a round trip through 
+    // an integer bit-exactly (so not -0, NaN or infinite), widening [min, max] 
+    // over them.  Returns 1 or 0, stopping at the first one that is not.
+    size_t i = 0;
+#if defined(MRCZ_HAVE_SSE2)
+    if( n >= 4 )
+    {   // Truncate to int32 and back, and compare the bits
+        __m128 vmin = _mm_loadu_ps( src ), vmax = vmin;
+        float lanes[8];
+        for( ; i + 16 <= n; i += 16 )
+        {
+            __m128i diff = _mm_setzero_si128();
+            for( size_t j = i; j < i + 16; j += 4 )
+            {
+                __m128 x = _mm_loadu_ps( &src[j] );
+                __m128 back = _mm_cvtepi32_ps( _mm_cvttps_epi32( x ) );
+                diff = _mm_or_si128( diff, _mm_xor_si128( _mm_castps_si128( x ), _mm_castps_si128( back ) ) );
+                vmin = _mm_min_ps( vmin, x );
+                vmax = _mm_max_ps( vmax, x );
+            }
+            if( _mm_movemask_epi8( _mm_cmpeq_epi32( diff, _mm_setzero_si128() ) ) != 0xFFFF )
+                return 0;
+        }
+        _mm_storeu_ps( &lanes[0], vmin );
+        _mm_storeu_ps( &lanes[4], vmax );
+        for( int j = 0; j < 4; j++ )
+        {
+            if( lanes[j] < *min ) *min = lanes[j];
+            if( lanes[4+j] > *max ) *max = lanes[4+j];
+        }
+    }
+#endif
+    for( ; i < n; i++ )
+    {
+        float v = src[i];
+        if( !(v > -2147483648.0f && v < 2147483648.0f) || v != (float)(int32_t)v || (v == 0.0f && signbit( v )) )
+            return 0;
+        if( v < *min ) *min = v;
+        if( v > *max ) *max = v;
+    }
+    return 1;
+}
+
+int32_t _integerTypeFor( double min, double max )
+{   // Smallest integer type that holds whole numbers in [min, max], or -1
+    if( min >= -128.0 && max <= 127.0 )
+        return MRC_INT8;
+    if( min >= -32768.0 && max <= 32767.0 )
+        return MRC_INT16;
+    if( min >= 0.0 && max <= 65535.0 )
+        return MRC_UINT16;
+    return -1;
+}
+
+int _detectIntegerType( mrcHeader *header, const float *data )
+{   // Integer type to store the float32 volume data losslessly as, checked 
+    // slice by slice so that real-valued data is rejected after one slice.  
+    // Returns -1 if there is none.
+    size_t sliceItems = (size_t)header->dimensions[0] * header->dimensions[1];
+    double min = HUGE_VAL, max = -HUGE_VAL;
+
+    for( int32_t k = 0; k < header->dimensions[2]; k++ )
+    {
+        if( !_floatsAreIntegers( &data[k * sliceItems], sliceItems, &min, &max ) 
+            || _integerTypeFor( min, max ) < 0 )
+            return -1;
+    }
+    return header->dimensions[2] > 0 ? _integerTypeFor( min, max ) : -1;
+}
+
+int _isLossy( mrcHeader *header )
+{   // Whether header asks for precision truncation of its data
+    if( header->mrcType != MRC_FLOAT32 && header->mrcType != MRC_COMPLEX64 )
+        return 0;
+    return (header->mantissaBits > 0 && header->mantissaBits < 23) || header->absoluteError > 0.0f;
+}
+
+void _truncatePrecision( const float *src, float *dest, size_t n, int32_t mantissaBits, float absoluteError )
+{   // Round n floats to nearest (ties to even) keeping mantissaBits of the 
+    // mantissa, or to a multiple of the largest power of two step that is 
+    // within absoluteError.  Either is skipped if 0.  With both, each value 
+    // is rounded once, to the finer of the two grids (the mantissa below 
+    // split, the step from there up), so that both error bounds hold.  
+    // Infinities and NaNs are kept, and a value that would round up to 
+    // infinity is truncated instead.
+    uint32_t drop = (mantissaBits > 0 && mantissaBits < 23) ? 23 - mantissaBits : 0;
+    uint32_t half = drop > 0 ? (1u << (drop - 1)) - 1 : 0, keep = ~((1u << drop) - 1);
+    float step = 0.0f, invStep = 0.0f, limit = 0.0f, split = drop > 0 ? HUGE_VALF : 0.0f;
+    size_t i = 0;
+
+    if( absoluteError > 0.0f )
+    {   // Values at or above limit are already multiples of step
+        int e;
+        frexpf( 2.0f * absoluteError, &e );
+        step = ldexpf( 1.0f, e - 1 );
+        if( step >= 1e-30f && step <= 1e30f )
+        {
+            invStep = 1.0f / step;
+            limit = step * 8388608.0f;
+            if( drop > 0 )
+                split = ldexpf( step, mantissaBits );
+        }
+    }
+#if defined(MRCZ_HAVE_SSE2)
+    {
+        const __m128i expMask = _mm_set1_epi32( 0x7f800000 ), halfv = _mm_set1_epi32( (int)half );
+        const __m128i keepv = _mm_set1_epi32( (int)keep ), one = _mm_set1_epi32( 1 );
+        const __m128i shift = _mm_cvtsi32_si128( (int)drop );
+        const __m128 absMask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+        const __m128 stepv = _mm_set1_ps( step ), invStepv = _mm_set1_ps( invStep ), limitv = _mm_set1_ps( limit );
+        const __m128 splitv = _mm_set1_ps( split );
+        for( ; i + 4 <= n; i += 4 )
+        {
+            __m128i u = _mm_castps_si128( _mm_loadu_ps( &src[i] ) );
+            __m128 x, magnitude = _mm_and_ps( _mm_castsi128_ps( u ), absMask );
+            if( drop > 0 )
+            {
+                __m128i lsb = _mm_and_si128( _mm_srl_epi32( u, shift ), one );
+                __m128i r = _mm_and_si128( _mm_add_epi32( u, _mm_add_epi32( halfv, lsb ) ), keepv );
+                __m128i special = _mm_cmpeq_epi32( _mm_and_si128( u, expMask ), expMask );
+                __m128i overflow = _mm_cmpeq_epi32( _mm_and_si128( r, expMask ), expMask );
+                r = _mm_or_si128( _mm_andnot_si128( overflow, r ), _mm_and_si128( overflow, _mm_and_si128( u, keepv ) ) );
+                special = _mm_or_si128( special, _mm_castps_si128( _mm_cmpge_ps( magnitude, splitv ) ) );
+                u = _mm_or_si128( _mm_andnot_si128( special, r ), _mm_and_si128( special, u ) );
+            }
+            x = _mm_castsi128_ps( u );
+            if( invStep > 0.0f )
+            {
+                __m128 small = _mm_and_ps( _mm_cmplt_ps( magnitude, limitv ), _mm_cmpge_ps( magnitude, splitv ) );
+                __m128 y = _mm_mul_ps( _mm_cvtepi32_ps( _mm_cvtps_epi32( _mm_mul_ps( x, invStepv ) ) ), stepv );
+                x = _mm_or_ps( _mm_and_ps( small, y ), _mm_andnot_ps( small, x ) );
+            }
+            _mm_storeu_ps( &dest[i], x );
+        }
+    }
+#endif
+    for( ; i < n; i++ )
+    {
+        uint32_t u;
+        float x;
+        memcpy( &u, &src[i], sizeof(u) );
+        if( drop > 0 && (u & 0x7f800000) != 0x7f800000 && fabsf( src[i] ) < split )
+        {
+            uint32_t r = (u + half + ((u >> drop) & 1)) & keep;
+            u = (r & 0x7f800000) == 0x7f800000 ? (u & keep) : r;
+        }
+        memcpy( &x, &u, sizeof(x) );
+        if( invStep > 0.0f && fabsf( src[i] ) < limit && fabsf( src[i] ) >= split )
+            x = rintf( x * invStep ) * step;
+        dest[i] = x;
+    }
+}
+
+void _deltaEncode( const uint8_t *cur, uint8_t *prev, uint8_t *residual, size_t nbytes, size_t itemsize )
+{   // residual = cur - prev, then prev = cur.  Integers are subtracted with 
+    // wrap-around (int8/int16/uint16), floats have their bit patterns XOR'ed so 
+    // that the shared sign/exponent/high mantissa bits become zeros.
+    size_t i = 0;
+#if defined(MRCZ_HAVE_SSE2)
+    for( ; i + 16 <= nbytes; i += 16 )
+    {
+        __m128i c = _mm_loadu_si128( (const __m128i*)&cur[i] );
+        __m128i p = _mm_loadu_si128( (const __m128i*)&prev[i] );
+        __m128i r;
+        if( itemsize == 1 )
+            r = _mm_sub_epi8( c, p );
+        else if( itemsize == 2 )
+            r = _mm_sub_epi16( c, p );
+        else
+            r = _mm_xor_si128( c, p );
+        _mm_storeu_si128( (__m128i*)&residual[i], r );
+        _mm_storeu_si128( (__m128i*)&prev[i], c );
+    }
+#endif
+    if( itemsize == 1 )
+    {
+        for( ; i < nbytes; i++ )
+        {
+            residual[i] = (uint8_t)(cur[i] - prev[i]);
+            prev[i] = cur[i];
+        }
+    }
+    else if( itemsize == 2 )
+    {
+        for( ; i < nbytes; i += 2 )
+        {
+            uint16_t c, p, r;
+            memcpy( &c, &cur[i], 2 );
+            memcpy( &p, &prev[i], 2 );
+            r = (uint16_t)(c - p);
+            memcpy( &residual[i], &r, 2 );
+            memcpy( &prev[i], &c, 2 );
+        }
+    }
+    else
+    {
+        for( ; i < nbytes; i++ )
+        {
+            residual[i] = cur[i] ^ prev[i];
+            prev[i] = cur[i];
+        }
+    }
+}
+
+void _deltaDecode( const uint8_t *residual, uint8_t *prev, uint8_t *cur, size_t nbytes, size_t itemsize )
+{   // Inverse of _deltaEncode: cur = prev = residual + prev
+    size_t i = 0;
+#if defined(MRCZ_HAVE_SSE2)
+    for( ; i + 16 <= nbytes; i += 16 )
+    {
+        __m128i r = _mm_loadu_si128( (const __m128i*)&residual[i] );
+        __m128i p = _mm_loadu_si128( (const __m128i*)&prev[i] );
+        __m128i c;
+        if( itemsize == 1 )
+            c = _mm_add_epi8( r, p );
+        else if( itemsize == 2 )
+            c = _mm_add_epi16( r, p );
+        else
+            c = _mm_xor_si128( r, p );
+        _mm_storeu_si128( (__m128i*)&prev[i], c );
+        _mm_storeu_si128( (__m128i*)&cur[i], c );
+    }
+#endif
+    if( itemsize == 1 )
+    {
+        for( ; i < nbytes; i++ )
+            cur[i] = prev[i] = (uint8_t)(residual[i] + prev[i]);
+    }
+    else if( itemsize == 2 )
+    {
+        for( ; i < nbytes; i += 2 )
+        {
+            uint16_t r, p;
+            memcpy( &r, &residual[i], 2 );
+            memcpy( &p, &prev[i], 2 );
+            p = (uint16_t)(r + p);
+            memcpy( &prev[i], &p, 2 );
+            memcpy( &cur[i], &p, 2 );
+        }
+    }
+    else
+    {
+        for( ; i < nbytes; i++ )
+            cur[i] = prev[i] = residual[i] ^ prev[i];
+    }
+}
+
+int64_t _encodeEvents( const uint8_t *slice, size_t nbytes, size_t itemsize, uint32_t maxEvents, 
+                       uint8_t *events, uint8_t *values )
+{   // Encode the non-zero items of slice as an event list into events (see 
+    // MRCZ_SPARSE_MAGIC), using values as scratch for up to maxEvents items.  
+    // Returns the size of the event list in bytes, or -1 if the slice has more 
+    // than maxEvents non-zero items.  All-zero 16-byte blocks are skipped with 
+    // SSE2.
+    uint32_t nEvents = 0, last = 0, gap;
+    size_t nItems = nbytes / itemsize, i = 0;
+    uint8_t *gaps = &events[MRCZ_SPARSE_HEADER_LEN];
+
+    while( i < nItems )
+    {
+#if defined(MRCZ_HAVE_SSE2)
+        if( (i*itemsize) % 16 == 0 && (i*itemsize) + 16 <= nbytes )
+        {
+            __m128i block = _mm_loadu_si128( (const __m128i*)&slice[i*itemsize] );
+            if( _mm_movemask_epi8( _mm_cmpeq_epi8( block, _mm_setzero_si128() ) ) == 0xFFFF )
+            {
+                i += 16 / itemsize;
+                continue;
+            }
+        }
+#endif
+        for( size_t b = 0; b < itemsize; b++ )
+        {
+            if( slice[i*itemsize + b] != 0 )
+            {
+                if( nEvents >= maxEvents )
+                    return -1;
+                gap = (uint32_t)i - last;
+                last = (uint32_t)i;
+                memcpy( &gaps[4*nEvents], &gap, sizeof(gap) );
+                memcpy( &values[itemsize*nEvents], &slice[i*itemsize], itemsize );
+                nEvents++;
+                break;
+            }
+        }
+        i++;
+    }
+    memcpy( &events[0], MRCZ_SPARSE_MAGIC, 4 );
+    memcpy( &events[4], &nEvents, sizeof(nEvents) );
+    memcpy( &gaps[4*nEvents], values, itemsize*nEvents );
+    return MRCZ_SPARSE_HEADER_LEN + (int64_t)nEvents * (4 + itemsize);
+}
+
+int _decodeEvents( const uint8_t *events, size_t eventBytes, uint8_t *slice, size_t nbytes, size_t itemsize )
+{   // Expand an event list back into a dense slice.  Returns 0 on success, or 
+    // -1 if the event list is corrupt.
+    uint32_t nEvents, gap;
+    size_t pos = 0;
+    const uint8_t *gaps = &events[8], *values;
+
+    if( eventBytes < 8 || memcmp( events, MRCZ_SPARSE_MAGIC, 4 ) != 0 )
+        return -1;
+    memcpy( &nEvents, &events[4], sizeof(nEvents) );
+    if( eventBytes != 8 + (size_t)nEvents * (4 + itemsize) )
+        return -1;
+    values = &gaps[4*nEvents];
+
+    memset( slice, 0, nbytes );
+    for( uint32_t e = 0; e < nEvents; e++ )
+    {
+        memcpy( &gap, &gaps[4*e], sizeof(gap) );
+        pos += gap;
+        if( (pos+1) * itemsize > nbytes )
+            return -1;
+        memcpy( &slice[pos*itemsize], &values[itemsize*e], itemsize );
+    }
+    return 0;
+}
+
+mrczReader* mrczReader_new( FILE *fh, mrcHeader *header )
+{   // Sequential slice-by-slice reader.  header must already be parsed and fh 
+    // must point to the start of the data (after any extended header).
+    mrczReader *self = calloc( 1, sizeof(*self) );
+    self->fh = fh;
+    self->header = header;
+    self->sliceBytes = (size_t)header->dimensions[0] * header->dimensions[1] * mrcHeader_itemsize( header );
+    if( header->blosc_compressor != BLOSC_COMPRESSOR_NONE && (header->mrczFlags & MRCZ_FLAG_CHECKSUM) )
+        self->crcs = malloc( header->dimensions[2] * sizeof(uint32_t) );
+    if( header->blosc_compressor != BLOSC_COMPRESSOR_NONE && header->mrcType == MRC_COMPLEX64
+        && (header->mrczFlags & MRCZ_FLAG_SPLITCOMPLEX) )
+        self->scratch = malloc( self->sliceBytes );
+    if( header->blosc_compressor != BLOSC_COMPRESSOR_NONE && (header->mrczFlags & MRCZ_FLAG_DELTA) )
+    {
+        self->prev = malloc( self->sliceBytes );
+        if( self->scratch == NULL )
+            self->scratch = malloc( self->sliceBytes );
+    }
+    if( header->blosc_compressor != BLOSC_COMPRESSOR_NONE && (header->mrczFlags & MRCZ_FLAG_SPARSE) )
+        self->events = malloc( self->sliceBytes );
+    if( header->blosc_compressor != BLOSC_COMPRESSOR_NONE && (header->mrczFlags & MRCZ_FLAG_DICTIONARY) )
+    {   // The caller may have the dictionary already, e.g. from another reader
+        const uint8_t *dictionary = header->dictionary;
+        size_t size = (size_t)header->dictionarySize;
+        if( dictionary == NULL )
+        {
+            dictionary = self->dictionary = _loadDictionary( fh, header );
+            size = (size_t)header->extendedHeaderSize;
+        }
+#if defined(MRCZ_HAVE_ZSTD_DICT)
+        if( dictionary != NULL )
+        {
+            self->zstd = ZSTD_createDCtx();
+            self->zstdDict = ZSTD_createDDict( dictionary, size );
+        }
+#else
+        (void)size;
+#endif
+    }
+    self->swapWidth = _swapWidth( header );
+    if( header->blosc_threads <= 0 )
+    {   // We should not get here if we used the mrcHeader_new factory, but a 
+        // user might.
+        printf( "Warning: blosc_threads set to %d, defaulting to %d.\n", 
+               header->blosc_threads, BLOSC_DEFAULT_THREADS );
+        header->blosc_threads = BLOSC_DEFAULT_THREADS;
+    }
+    return self;
+}
+
+int mrczReader_readSlice( mrczReader *self, void *dest )
+{   // Read (and decompress) the next z-slice into dest, which must hold 
+    // self->sliceBytes.  After the last slice the chunk index is checked, if 
+    // the file has one.  Returns 0 on success, or -1.
+    uint32_t k = self->next, nbytes;
+    int cbytes, blosc_ret;
+
+    if( k >= (uint32_t)self->header->dimensions[2] )
+        return -1;
+    if( self->header->blosc_compressor == BLOSC_COMPRESSOR_NONE )
+    {
+        if( self->entries != NULL )
+            fseek( self->fh, self->entries[k].offset, SEEK_SET );
+        if( fread( dest, sizeof(uint8_t), self->sliceBytes, self->fh ) != self->sliceBytes )
+        {
+            printf( "Error: mrczReader could not read slice %u\n", k );
+            return -1;
+        }
+        _byteSwap( (uint8_t*)dest, self->sliceBytes, self->swapWidth );
+        self->next++;
+        return 0;
+    }
+
+#if defined(MRCZ_HAVE_PTHREADS)
+    if( self->ioLock != NULL )
+        pthread_mutex_lock( (pthread_mutex_t*)self->ioLock );
+#endif
+    if( self->entries != NULL )
+        fseek( self->fh, self->entries[k].offset, SEEK_SET );
+    cbytes = _readChunk( self->fh, &self->bloscRepr, &self->bloscCapacity );
+#if defined(MRCZ_HAVE_PTHREADS)
+    if( self->ioLock != NULL )
+        pthread_mutex_unlock( (pthread_mutex_t*)self->ioLock );
+#endif
+    if( cbytes < 0 )
+    {
+        printf( "Error: mrczReader could not read the chunk for slice %u\n", k );
+        return -1;
+    }
+    if( self->crcs != NULL )
+        self->crcs[k] = _crc32c( 0, self->bloscRepr, cbytes );
+    else if( self->entries != NULL && (self->header->mrczFlags & MRCZ_FLAG_CHECKSUM)
+             && _crc32c( 0, self->bloscRepr, cbytes ) != self->entries[k].crc32c )
+    {
+        printf( "Error: mrczReader found a checksum mismatch in slice %u of %s\n", k, self->header->metaname );
+        return -1;
+    }
+
+    memcpy( &nbytes, &self->bloscRepr[4], sizeof(nbytes) );
+    if( self->events != NULL && nbytes < self->sliceBytes )
+    {   // Sparse slice stored as an event list
+        if( self->swapWidth != 0 )
+        {
+            printf( "Error: mrczReader cannot decode events written in the other byte order\n" );
+            return -1;
+        }
+        blosc_ret = _decompressChunk( self, self->events, self->sliceBytes );
+        if( blosc_ret != (int)nbytes 
+            || _decodeEvents( self->events, nbytes, self->scratch != NULL ? self->scratch : (uint8_t*)dest, 
+                              self->sliceBytes, _filteredItemsize( self->header ) ) != 0 )
+        {
+            printf( "Error: mrczReader failed to decode the events of slice %u\n", k );
+            return -1;
+        }
+    }
+    else
+    {
+        blosc_ret = _decompressChunk( self, self->scratch != NULL ? self->scratch : (uint8_t*)dest, 
+                                      self->sliceBytes );
+        if( blosc_ret != (int)self->sliceBytes )
+        {
+            printf( "Error: mrczReader failed on slice %u with blosc code %d\n", k, blosc_ret );
+            return -1;
+        }
+    }
+
+    // Foreign byte order is fixed before the filters, which work on values
+    _byteSwap( self->scratch != NULL ? self->scratch : (uint8_t*)dest, self->sliceBytes, self->swapWidth );
+
+    // Undo the filters in the reverse order of mrczWriter_writeSlice
+    if( self->scratch != NULL )
+    {
+        int split = self->header->mrcType == MRC_COMPLEX64 && (self->header->mrczFlags & MRCZ_FLAG_SPLITCOMPLEX);
+        uint8_t *filtered = split ? self->scratch : (uint8_t*)dest;
+        if( self->prev != NULL )
+        {
+            if( k % _keyframeInterval( self->header ) == 0 )
+            {
+                memcpy( self->prev, self->scratch, self->sliceBytes );
+                if( !split )
+                    memcpy( dest, self->scratch, self->sliceBytes );
+            }
+            else
+            {
+                _deltaDecode( self->scratch, self->prev, filtered, self->sliceBytes, 
+                              _filteredItemsize( self->header ) );
+            }
+        }
+        if( split )
+            _mergeComplex( (float*)self->scratch, (float*)dest, self->sliceBytes / 8 );
+    }
+    self->next++;
+
+    if( self->next == (uint32_t)self->header->dimensions[2] && self->crcs != NULL )
+    {
+        if( _checkChunkIndex( self->fh, self->crcs, self->next, self->header->metaname ) != 0 )
+            return -1;
+    }
+    return 0;
+}
+
+void _mrczReader_seek( mrczReader *self, uint32_t k, int64_t offset )
+{   // Restart the reader at slice k, whose chunk is at offset in the file.  
+    // With MRCZ_FLAG_DELTA, k must be a keyframe.  Checksums can only be 
+    // checked for a complete pass over the file, so they are disabled.
+    if( self->entries == NULL )
+        fseek( self->fh, offset, SEEK_SET );
+    self->next = k;
+    free( self->crcs );
+    self->crcs = NULL;
+}
+
+void mrczReader_free( mrczReader *self )
+{
+    free( self->bloscRepr );
+    free( self->scratch );
+    free( self->prev );
+    free( self->events );
+    free( self->crcs );
+    free( self->dictionary );
+#if defined(MRCZ_HAVE_ZSTD_DICT)
+    ZSTD_freeDCtx( (ZSTD_DCtx*)self->zstd );
+    ZSTD_freeDDict( (ZSTD_DDict*)self->zstdDict );
+#endif
+    free( self );
+}
+
+int _decompressChunk( mrczReader *self, void *dest, size_t destBytes )
+{   // Decompress the chunk in self->bloscRepr into dest, with blosc or, for 
+    // MRCZ_FLAG_DICTIONARY, with zstd and the dictionary of the file.  Returns 
+    // the number of bytes decompressed, or < 0.
+    const uint8_t *chunk = self->bloscRepr;
+    uint32_t nbytes, cbytes;
+
+    if( !(self->header->mrczFlags & MRCZ_FLAG_DICTIONARY) )
+        return blosc_decompress_ctx( chunk, dest, destBytes, self->header->blosc_threads );
+    memcpy( &nbytes, &chunk[4], sizeof(nbytes) );
+    memcpy( &cbytes, &chunk[12], sizeof(cbytes) );
+    if( nbytes > destBytes )
+        return -1;
+    if( chunk[2] & BLOSC_MEMCPYED )
+    {
+        if( cbytes - BLOSC_MIN_HEADER_LENGTH != nbytes )
+            return -1;
+        memcpy( dest, &chunk[BLOSC_MIN_HEADER_LENGTH], nbytes );
+        return (int)nbytes;
+    }
+#if defined(MRCZ_HAVE_ZSTD_DICT)
+    if( self->zstd != NULL )
+    {
+        size_t ret = ZSTD_decompress_usingDDict( (ZSTD_DCtx*)self->zstd, dest, destBytes, 
+                                                 &chunk[BLOSC_MIN_HEADER_LENGTH], cbytes - BLOSC_MIN_HEADER_LENGTH, 
+                                                 (const ZSTD_DDict*)self->zstdDict );
+        return ZSTD_isError( ret ) ? -1 : (int)ret;
+    }
+#endif
+    printf( "Error: %s needs its zstd dictionary, which requires c-mrcz built with USE_ZSTD_DICT\n", 
+            self->header->metaname );
+    return -1;
+}
+
+#define _BIN_SLICE( type, src, sums, sx, sy, tx, nc )                              \
+    for( size_t y = 0; y < (sy); y++ )                                             \
+    {                                                                              \
+        const type *row = &((const type*)(src))[y * (sx) * (nc)];                  \
+        float *binned = &(sums)[(y >> 1) * (tx) * (nc)];                           \
+        for( size_t x = 0; x < (sx) * (nc); x++ )                                  \
+            binned[(x / (nc) >> 1) * (nc) + x % (nc)] += (float)row[x];             \
+    }
+
+mrczPyramid* _mrczPyramid_new( mrcHeader *header )
+{   // Builder of header->pyramidLevels overviews (at most 
+    // MRCZ_MAX_PYRAMID_LEVELS), or NULL if there are none.
+    mrczPyramid *self;
+    size_t itemsize = mrcHeader_itemsize( header );
+
+    if( header->pyramidLevels <= 0 || header->blosc_compressor == BLOSC_COMPRESSOR_NONE )
+        return NULL;
+    self = calloc( 1, sizeof(*self) );
+    self->header = header;
+    self->nLevels = header->pyramidLevels < MRCZ_MAX_PYRAMID_LEVELS ? header->pyramidLevels : MRCZ_MAX_PYRAMID_LEVELS;
+    self->chunks = tmpfile();
+    if( self->chunks == NULL )
+    {
+        printf( "Error: mrczWriter could not create a temporary file for the pyramid\n" );
+        free( self );
+        return NULL;
+    }
+    memcpy( self->levels[0].dimensions, header->dimensions, sizeof(header->dimensions) );
+    for( int L = 1; L <= self->nLevels; L++ )
+    {
+        size_t nItems;
+        for( int i = 0; i < 3; i++ )
+            self->levels[L].dimensions[i] = (self->levels[L-1].dimensions[i] + 1) / 2;
+        nItems = (size_t)self->levels[L].dimensions[0] * self->levels[L].dimensions[1];
+        self->sums[L] = calloc( nItems * (header->mrcType == MRC_COMPLEX64 ? 2 : 1), sizeof(float) );
+        self->slices[L] = malloc( nItems * itemsize );
+        self->entries[L] = calloc( self->levels[L].dimensions[2], sizeof(mrczChunkEntry) );
+    }
+    self->bloscCapacity = (size_t)self->levels[1].dimensions[0] * self->levels[1].dimensions[1] * itemsize 
+                          + BLOSC_MAX_OVERHEAD;
+    self->bloscRepr = malloc( self->bloscCapacity );
+    return self;
+}
+
+int _mrczPyramid_add( mrczPyramid *self, int level, const void *src )
+{   // Bin src, the next slice of level - 1, into level.  Once two slices (or 
+    // the last one) are in, the mean is compressed as the next slice of level 
+    // and passed on to the level above.  Returns 0 or -1.
+    mrcHeader *header = self->header;
+    size_t sx = self->levels[level-1].dimensions[0], sy = self->levels[level-1].dimensions[1];
+    size_t tx = self->levels[level].dimensions[0], ty = self->levels[level].dimensions[1];
+    size_t nc = header->mrcType == MRC_COMPLEX64 ? 2 : 1;
+    size_t itemsize = mrcHeader_itemsize( header );
+    float *sums = self->sums[level];
+    uint8_t *slice = self->slices[level];
+    uint32_t k = self->next[level-1]++;
+    int blosc_ret;
+
+    switch( header->mrcType )
+    {
+        case MRC_INT8:      _BIN_SLICE( int8_t, src, sums, sx, sy, tx, nc ); break;
+        case MRC_INT16:     _BIN_SLICE( int16_t, src, sums, sx, sy, tx, nc ); break;
+        case MRC_UINT16:    _BIN_SLICE( uint16_t, src, sums, sx, sy, tx, nc ); break;
+        case MRC_FLOAT32:
+        case MRC_COMPLEX64: _BIN_SLICE( float, src, sums, sx, sy, tx, nc ); break;
+    }
+    if( k % 2 == 0 && k + 1 < (uint32_t)self->levels[level-1].dimensions[2] )
+        return 0;
+
+    for( size_t y = 0; y < ty; y++ )
+    {
+        float cy = (2*y + 1 < sy) ? 2.0f : 1.0f;
+        for( size_t x = 0; x < tx * nc; x++ )
+        {
+            size_t i = y * tx * nc + x;
+            float n = cy * ((2*(x / nc) + 1 < sx) ? 2.0f : 1.0f) * (float)(k % 2 + 1);
+            float mean = sums[i] / n;
+            switch( header->mrcType )
+            {
+                case MRC_INT8:   ((int8_t*)slice)[i] = (int8_t)lrintf( mean ); break;
+                case MRC_INT16:  ((int16_t*)slice)[i] = (int16_t)lrintf( mean ); break;
+                case MRC_UINT16: ((uint16_t*)slice)[i] = (uint16_t)lrintf( mean ); break;
+                default:         ((float*)slice)[i] = mean; break;
+            }
+        }
+    }
+    memset( sums, 0, tx * ty * nc * sizeof(float) );
+
+    blosc_ret = blosc_compress_ctx( header->blosc_clevel, header->blosc_filter, itemsize / nc, 
+                                    tx * ty * itemsize, slice, self->bloscRepr, self->bloscCapacity, 
+                                    _compressorName( header->blosc_compressor ), 
+                                    header->blosc_blocksize, header->blosc_threads );
+    if( blosc_ret <= 0 || fwrite( self->bloscRepr, sizeof(uint8_t), blosc_ret, self->chunks ) != (size_t)blosc_ret )
+    {
+        printf( "Error: mrczWriter failed on slice %u of pyramid level %d\n", k / 2, level );
+        return -1;
+    }
+    self->entries[level][k/2].offset = self->chunkBytes;
+    self->entries[level][k/2].cbytes = blosc_ret;
+    self->entries[level][k/2].crc32c = _crc32c( 0, self->bloscRepr, blosc_ret );
+    self->chunkBytes += blosc_ret;
+
+    if( level < self->nLevels )
+        return _mrczPyramid_add( self, level + 1, slice );
+    return 0;
+}
+
+int _mrczPyramid_write( mrczPyramid *self, FILE *fh, int64_t pos )
+{   // Write the "PYRM" trailer section at the current position of fh, which is 
+    // pos in the file (fh may be a pipe).
+    mrczSection section;
+    uint64_t nEntries = 0;
+    int64_t base;
+    uint8_t buffer[65536];
+    size_t nread;
+
+    for( int L = 1; L <= self->nLevels; L++ )
+        nEntries += self->levels[L].dimensions[2];
+    memcpy( section.tag, MRCZ_SECTION_PYRAMID, sizeof(section.tag) );
+    section.count = self->nLevels;
+    section.bytes = self->nLevels * sizeof(mrczPyramidLevel) + nEntries * sizeof(mrczChunkEntry) + self->chunkBytes;
+    if( fwrite( &section, sizeof(section), 1, fh ) != 1 
+        || fwrite( &self->levels[1], sizeof(mrczPyramidLevel), self->nLevels, fh ) != (size_t)self->nLevels )
+        return -1;
+
+    // Chunk offsets become absolute
+    base = pos + sizeof(section) + self->nLevels * sizeof(mrczPyramidLevel) + nEntries * sizeof(mrczChunkEntry);
+    for( int L = 1; L <= self->nLevels; L++ )
+    {
+        uint32_t nz = self->levels[L].dimensions[2];
+        for( uint32_t k = 0; k < nz; k++ )
+            self->entries[L][k].offset += base;
+        if( fwrite( self->entries[L], sizeof(mrczChunkEntry), nz, fh ) != nz )
+            return -1;
+    }
+    fseek( self->chunks, 0, SEEK_SET );
+    while( (nread = fread( buffer, sizeof(uint8_t), sizeof(buffer), self->chunks )) > 0 )
+    {
+        if( fwrite( buffer, sizeof(uint8_t), nread, fh ) != nread )
+            return -1;
+    }
+    return 0;
+}
+
+void _mrczPyramid_free( mrczPyramid *self )
+{
+    if( self == NULL )
+        return;
+    for( int L = 1; L <= self->nLevels; L++ )
+    {
+        free( self->sums[L] );
+        free( self->slices[L] );
+        free( self->entries[L] );
+    }
+    free( self->bloscRepr );
+    fclose( self->chunks );
+    free( self );
+}
+
+int _hasDictionary( mrcHeader *header )
+{   // Whether chunks are to be written with header->dictionary.  Without 
+    // USE_ZSTD_DICT such chunks can still be copied, but not compressed.
+    return (header->mrczFlags & MRCZ_FLAG_DICTIONARY) && header->dictionary != NULL 
+           && header->dictionarySize > 0 && header->blosc_compressor == BLOSC_COMPRESSOR_ZSTD;
+}
+
+uint8_t* _loadDictionary( FILE *fh, mrcHeader *header )
+{   // Read the zstd dictionary of a file with MRCZ_FLAG_DICTIONARY from its 
+    // extended header, leaving fh where it was.  Returns a buffer for the 
+    // caller to free, or NULL.
+    long pos = ftell( fh );
+    size_t size = (size_t)header->extendedHeaderSize;
+    uint8_t *dictionary;
+
+    if( header->extendedHeaderSize <= 0 )
+        return NULL;
+    dictionary = malloc( size );
+    if( fseek( fh, MRC_HEADER_LEN, SEEK_SET ) != 0 || fread( dictionary, sizeof(uint8_t), size, fh ) != size )
+    {
+        printf( "Error: could not read the zstd dictionary of %s\n", header->metaname );
+        free( dictionary );
+        dictionary = NULL;
+    }
+    fseek( fh, pos, SEEK_SET );
+    return dictionary;
+}
+
+int64_t trainDictionaryMRCZ( const void *slices, size_t sliceBytes, uint32_t nSlices, 
+                             uint8_t *dictionary, size_t capacity )
+{   // Train a zstd dictionary of at most capacity bytes from nSlices 
+    // consecutive slices, each one a sample.  Returns its size, or -1.
+#if defined(MRCZ_HAVE_ZSTD_DICT)
+    size_t *sizes = malloc( nSlices * sizeof(size_t) ), size;
+
+    for( uint32_t k = 0; k < nSlices; k++ )
+        sizes[k] = sliceBytes;
+    size = ZDICT_trainFromBuffer( dictionary, capacity, slices, sizes, nSlices );
+    free( sizes );
+    if( ZDICT_isError( size ) )
+    {
+        printf( "Error: could not train a zstd dictionary from %u slices: %s\n", nSlices, ZDICT_getErrorName( size ) );
+        return -1;
+    }
+    return (int64_t)size;
+#else
+    (void)slices; (void)sliceBytes; (void)nSlices; (void)dictionary; (void)capacity;
+    printf( "Error: zstd dictionaries require c-mrcz built with USE_ZSTD_DICT\n" );
+    return -1;
+#endif
+}
+
+int _trainVolumeDictionary( mrcHeader *header, const uint8_t *data, uint8_t **dictionary )
+{   // Train a dictionary of header->dictionarySize bytes (or the default) from 
+    // evenly spaced slices of a whole volume.  Returns its size with 
+    // *dictionary to free, or -1.
+    size_t capacity = header->dictionarySize > 0 ? (size_t)header->dictionarySize : MRCZ_DEFAULT_DICTIONARY;
+    size_t sliceBytes = (size_t)header->dimensions[0] * header->dimensions[1] * mrcHeader_itemsize( header );
+    uint32_t dz = header->dimensions[2], nSamples = dz;
+    const uint8_t *samples = data;
+    uint8_t *gathered = NULL;
+    int64_t size;
+
+    if( sliceBytes == 0 || dz == 0 )
+        return -1;
+    if( (uint64_t)sliceBytes * dz > (uint64_t)capacity * MRCZ_DICTIONARY_SAMPLES )
+    {
+        nSamples = (uint32_t)((uint64_t)capacity * MRCZ_DICTIONARY_SAMPLES / sliceBytes);
+        nSamples = nSamples > 0 ? nSamples : 1;
+        samples = gathered = malloc( nSamples * sliceBytes );
+        for( uint32_t i = 0; i < nSamples; i++ )
+            memcpy( &gathered[i * sliceBytes], &data[((uint64_t)i * dz / nSamples) * sliceBytes], sliceBytes );
+    }
+    *dictionary = malloc( capacity );
+    size = trainDictionaryMRCZ( samples, sliceBytes, nSamples, *dictionary, capacity );
+    free( gathered );
+    if( size < 0 )
+    {
+        free( *dictionary );
+        *dictionary = NULL;
+    }
+    return (int)size;
+}
+
+int _compressDictChunk( mrczWriter *self, size_t typesize, size_t nbytes, const void *src )
+{   // Compress nbytes of src into self->bloscRepr as a 16-byte blosc-style 
+    // header and a zstd frame made with the writer's dictionary, or the raw 
+    // bytes if that is no smaller.  Returns the size of the chunk, or -1.
+#if defined(MRCZ_HAVE_ZSTD_DICT)
+    uint8_t *chunk = self->bloscRepr;
+    uint32_t nbytes32 = (uint32_t)nbytes, cbytes;
+    size_t zbytes = self->zstdDict == NULL ? (size_t)-1 : ZSTD_compress_usingCDict( (ZSTD_CCtx*)self->zstd, &chunk[BLOSC_MIN_HEADER_LENGTH], 
+                                              self->bloscCapacity - BLOSC_MIN_HEADER_LENGTH, src, nbytes, 
+                                              (const ZSTD_CDict*)self->zstdDict );
+    chunk[0] = BLOSC_VERSION_FORMAT;
+    chunk[1] = 1;
+    chunk[2] = BLOSC_ZSTD_FORMAT << 5;
+    chunk[3] = (uint8_t)typesize;
+    if( ZSTD_isError( zbytes ) || zbytes >= nbytes )
+    {   // Incompressible, possibly too big for the buffer
+        memcpy( &chunk[BLOSC_MIN_HEADER_LENGTH], src, nbytes );
+        zbytes = nbytes;
+        chunk[2] |= BLOSC_MEMCPYED;
+    }
+    cbytes = (uint32_t)(zbytes + BLOSC_MIN_HEADER_LENGTH);
+    memcpy( &chunk[4], &nbytes32, sizeof(nbytes32) );
+    memcpy( &chunk[8], &nbytes32, sizeof(nbytes32) );  // a single block
+    memcpy( &chunk[12], &cbytes, sizeof(cbytes) );
+    return (int)cbytes;
+#else
+    (void)self; (void)typesize; (void)nbytes; (void)src;
+    printf( "Error: zstd dictionaries require c-mrcz built with USE_ZSTD_DICT\n" );
+    return -1;
+#endif
+}
+
+mrczWriter* mrczWriter_new( FILE *fh, mrcHeader *header )
+{   // Sequential slice-by-slice writer.  fh must point to the start of the 
+    // data section, i.e. the header has been written already.
+    mrczWriter *self = calloc( 1, sizeof(*self) );
+    self->fh = fh;
+    self->header = header;
+    self->sliceBytes = (size_t)header->dimensions[0] * header->dimensions[1] * mrcHeader_itemsize( header );
+    self->chunkPos = ftell( fh );
+    if( self->chunkPos < 0 )
+    {   // A pipe, just after the header
+        self->chunkPos = MRC_HEADER_LEN + header->extendedHeaderSize;
+    }
+    if( _isLossy( header ) )
+        self->rounded = malloc( self->sliceBytes );
+    if( header->blosc_compressor != BLOSC_COMPRESSOR_NONE )
+    {   // Maximum size of slice in compressed bytes, blosc may add its header 
+        // to incompressible data.
+        self->bloscCapacity = self->sliceBytes + BLOSC_MAX_OVERHEAD;
+        self->bloscRepr = malloc( self->bloscCapacity );
+        if( header->mrczFlags & MRCZ_FLAG_CHECKSUM )
+            self->entries = calloc( header->dimensions[2], sizeof(mrczChunkEntry) );
+        if( header->mrcType == MRC_COMPLEX64 && (header->mrczFlags & MRCZ_FLAG_SPLITCOMPLEX) )
+            self->scratch = malloc( self->sliceBytes );
+        if( header->mrczFlags & MRCZ_FLAG_DELTA )
+        {
+            self->prev = malloc( self->sliceBytes );
+            self->residual = malloc( self->sliceBytes );
+        }
+        if( header->mrczFlags & MRCZ_FLAG_SPARSE )
+        {   // An all-zero slice still takes the event list header
+            self->events = malloc( self->sliceBytes + MRCZ_SPARSE_HEADER_LEN );
+            self->values = malloc( self->sliceBytes );
+        }
+        self->pyramid = _mrczPyramid_new( header );
+#if defined(MRCZ_HAVE_ZSTD_DICT)
+        if( _hasDictionary( header ) )
+        {   // Levels 1-9 map onto zstd's in the same way as in blosc
+            int level = header->blosc_clevel < 9 ? 2 * header->blosc_clevel - 1 : ZSTD_maxCLevel();
+            self->zstd = ZSTD_createCCtx();
+            self->zstdDict = ZSTD_createCDict( header->dictionary, (size_t)header->dictionarySize, level );
+        }
+#endif
+    }
+#ifndef NDEBUG
+    printf( "mrczWriter: compressor_str: %s, clevel: %d, filter: %d, blocksize: %lu, threads: %d\n", 
+           _compressorName( header->blosc_compressor ), header->blosc_clevel, header->blosc_filter, 
+           header->blosc_blocksize, header->blosc_threads);
+#endif
+    return self;
+}
+
+int mrczWriter_writeSlice( mrczWriter *self, const void *src )
+{   // Compress and write the next z-slice.  Returns 0 on success, or -1.
+    mrcHeader *header = self->header;
+    uint32_t k = self->next;
+    size_t typesize = mrcHeader_itemsize( header );
+    size_t nbytes = self->sliceBytes;
+    const void *slice = src;
+    int blosc_ret;
+
+    if( k >= (uint32_t)header->dimensions[2] )
+        return -1;
+    if( self->rounded != NULL )
+    {   // Lossy precision truncation, which all later stages see
+        _truncatePrecision( (const float*)src, (float*)self->rounded, self->sliceBytes / sizeof(float), 
+                            header->mantissaBits, header->absoluteError );
+        src = slice = self->rounded;
+    }
+    if( header->blosc_compressor == BLOSC_COMPRESSOR_NONE )
+    {
+        if( fwrite( src, sizeof(uint8_t), self->sliceBytes, self->fh ) != self->sliceBytes )
+        {
+            printf( "Error: mrczWriter could not write slice %u\n", k );
+            return -1;
+        }
+        self->chunkPos += self->sliceBytes;
+        self->next++;
+        return 0;
+    }
+
+    if( self->scratch != NULL )
+    {   // Real and imaginary planes are shuffled as separate float32s
+        _splitComplex( (const float*)src, (float*)self->scratch, self->sliceBytes / 8 );
+        src = self->scratch;
+        typesize = sizeof(float);
+    }
+    if( self->prev != NULL )
+    {   // Inter-slice predictor, keyframes are stored as-is
+        if( k % _keyframeInterval( header ) == 0 )
+        {
+            memcpy( self->prev, src, self->sliceBytes );
+        }
+        else
+        {
+            _deltaEncode( (const uint8_t*)src, self->prev, self->residual, self->sliceBytes, typesize );
+            src = self->residual;
+        }
+    }
+    if( self->events != NULL && self->sliceBytes > MRCZ_SPARSE_HEADER_LEN + 4 + typesize )
+    {   // Event list if the slice is sparse enough, and smaller than a slice.  
+        // Tiny slices, with no room for the header and one event, stay dense.
+        double fill = header->sparseThreshold > 0.0f ? header->sparseThreshold : MRCZ_DEFAULT_SPARSE_FILL;
+        size_t nItems = self->sliceBytes / typesize;
+        size_t room = (self->sliceBytes - MRCZ_SPARSE_HEADER_LEN - 1) / (4 + typesize);
+        uint32_t maxEvents = (uint32_t)(fill * nItems);
+        int64_t eventBytes;
+        if( maxEvents > room )
+            maxEvents = (uint32_t)room;
+        eventBytes = _encodeEvents( (const uint8_t*)src, self->sliceBytes, typesize, maxEvents, 
+                                    self->events, self->values );
+        if( eventBytes >= 0 )
+        {
+            src = self->events;
+            nbytes = (size_t)eventBytes;
+            typesize = 4;
+        }
+    }
+
+    if( _hasDictionary( header ) )
+        blosc_ret = _compressDictChunk( self, typesize, nbytes, src );
+    else
+        blosc_ret = blosc_compress_ctx( header->blosc_clevel, 
+                                        header->blosc_filter, 
+                                        typesize, 
+                                        nbytes, 
+                                        src, 
+                                        self->bloscRepr, 
+                                        self->bloscCapacity, 
+                                        _compressorName( header->blosc_compressor ), 
+                                        header->blosc_blocksize, 
+                                        header->blosc_threads );
+    if( blosc_ret <= 0 ) 
+    { 
+        printf( "Error: mrczWriter failed on slice %u with blosc code %d\n", k, blosc_ret );
+        return -1;
+    }
+    if( fwrite( self->bloscRepr, sizeof(uint8_t), blosc_ret, self->fh ) != (size_t)blosc_ret )
+    {
+        printf( "Error: mrczWriter could not write slice %u\n", k );
+        return -1;
+    }
+#ifndef NDEBUG        
+    printf( "mrczWriter: from %lu to %d bytes\n", nbytes, blosc_ret );
+#endif
+    if( self->entries != NULL )
+    {
+        self->entries[k].offset = self->chunkPos;
+        self->entries[k].cbytes = blosc_ret;
+        self->entries[k].crc32c = _crc32c( 0, self->bloscRepr, blosc_ret );
+    }
+    self->chunkPos += blosc_ret;
+    self->next++;
+    if( self->pyramid != NULL )
+        return _mrczPyramid_add( self->pyramid, 1, slice );
+    return 0;
+}
+
+int mrczWriter_writeFloatSlice( mrczWriter *self, const float *src )
+{   // Quantize a float32 slice with header->quantScale and quantOffset into 
+    // the integer mrcType of the writer, then write it.  Returns 0 or -1.
+    size_t nItems = (size_t)self->header->dimensions[0] * self->header->dimensions[1];
+    float lo, hi;
+
+    if( _quantizeRange( self->header->mrcType, &lo, &hi ) != 0 || self->header->quantScale == 0.0f )
+    {
+        printf( "Error: mrczWriter cannot quantize float32 slices to mrcType %d\n", self->header->mrcType );
+        return -1;
+    }
+    if( self->quantized == NULL )
+        self->quantized = malloc( self->sliceBytes );
+    _quantizeFloats( src, self->quantized, nItems, self->header->mrcType, 
+                     self->header->quantScale, self->header->quantOffset );
+    return mrczWriter_writeSlice( self, self->quantized );
+}
+
+int _mrczWriter_copyChunk( mrczWriter *self, const uint8_t *chunk, int cbytes )
+{   // Write an already compressed chunk as the next slice.  The caller must 
+    // make sure it was compressed with the same representation (type, shape, 
+    // MRCZ filters and keyframes) as the writer's header.  Returns 0 or -1.
+    uint32_t k = self->next;
+
+    if( self->pyramid != NULL )
+    {
+        printf( "Error: mrczWriter cannot bin copied chunks into a pyramid\n" );
+        return -1;
+    }
+    if( fwrite( chunk, sizeof(uint8_t), cbytes, self->fh ) != (size_t)cbytes )
+    {
+        printf( "Error: mrczWriter could not write slice %u\n", k );
+        return -1;
+    }
+    if( self->entries != NULL )
+    {
+        self->entries[k].offset = self->chunkPos;
+        self->entries[k].cbytes = cbytes;
+        self->entries[k].crc32c = _crc32c( 0, chunk, cbytes );
+    }
+    self->chunkPos += cbytes;
+    self->next++;
+    return 0;
+}
+
+int mrczWriter_free( mrczWriter *self )
+{   // Finish the file by writing the trailer (if any), and free the writer.
+    // Returns 0 on success, or -1 if the trailer could not be written.
+    int ret = 0;
+    if( self->entries != NULL || self->pyramid != NULL )
+        ret = _writeTrailer( self->fh, self->chunkPos, self->entries, self->next, self->pyramid );
+    _mrczPyramid_free( self->pyramid );
+    free( self->entries );
+    free( self->bloscRepr );
+    free( self->scratch );
+    free( self->prev );
+    free( self->residual );
+    free( self->events );
+    free( self->values );
+    free( self->rounded );
+    free( self->quantized );
+#if defined(MRCZ_HAVE_ZSTD_DICT)
+    ZSTD_freeCCtx( (ZSTD_CCtx*)self->zstd );
+    ZSTD_freeCDict( (ZSTD_CDict*)self->zstdDict );
+#endif
+    free( self );
+    return ret;
+}
+
+int _decompressMRCZ( FILE *fh, mrcVolume *dest )
+{
+    // fh must point to the start of the first blosc (16-byte) header
+    size_t dx = dest->header->dimensions[0]; 
+    size_t dy = dest->header->dimensions[1];                                
+    size_t dz = dest->header->dimensions[2];
+    size_t dsize = dx * dy * dz;
+    uint8_t *bytesRepr = NULL;
+    uint32_t allocFlags = dest->allocator.flags;
+
+    if( dest->header->numaAware )
+    {   // Pages are pre-faulted by the NUMA workers instead
+        dest->allocator.flags &= ~MRCZ_ALLOC_PREFAULT;
+    }
+    bytesRepr = _mrcVolume_alloc( dest, dsize * mrcHeader_itemsize( dest->header ) );
+    dest->allocator.flags = allocFlags;
+    if( bytesRepr == NULL )
+    {
+        printf( "Error: _decompressMRCZ could not allocate memory for mrcType %d\n", dest->header->mrcType );
+        return -1;
+    }
+    return _decompressInto( fh, dest->header, bytesRepr, allocFlags & MRCZ_ALLOC_PREFAULT );
+}
+
+int _decompressInto( FILE *fh, mrcHeader *header, uint8_t *bytesRepr, int prefault )
+{   // Decode all the slices from fh, which must point to the start of the 
+    // data, into bytesRepr.  Returns 0 on success, or -1.
+    int ret = 0;
+    uint32_t dz = header->dimensions[2];
+    mrczReader *reader;
+
+    if( header->histogram != NULL )
+        _histogramStart( header->histogram, header );
+#if defined(MRCZ_HAVE_NUMA)
+    if( header->numaAware && header->blosc_compressor != BLOSC_COMPRESSOR_NONE 
+        && !(header->mrczFlags & MRCZ_FLAG_DICTIONARY) )
+    {
+        ret = _decompressNUMA( fh, header, bytesRepr, prefault );
+        if( ret == 0 && header->histogram != NULL )
+            _histogramFinish( header->histogram );
+        return ret;
+    }
+#endif
+    (void)prefault;
+
+    reader = mrczReader_new( fh, header );
+    // Iterate through each z-axis slice as a chunk and decompress 
+    // each one, counting it into the histogram while it is in cache.
+    for( uint32_t k = 0; k < dz && ret == 0; k++ )
+    {
+        ret = mrczReader_readSlice( reader, &bytesRepr[k*reader->sliceBytes] );
+        if( header->histogram != NULL )
+            _histogramSlice( header->histogram->keys, header->mrcType, &bytesRepr[k*reader->sliceBytes], 
+                             reader->sliceBytes / mrcHeader_itemsize( header ) );
+    }
+    mrczReader_free( reader );
+    if( ret == 0 && header->histogram != NULL )
+        _histogramFinish( header->histogram );
+    return ret;
+}
+
+#if defined(MRCZ_HAVE_NUMA)
+typedef struct _numaWorker
+{
+    pthread_t thread;
+    FILE *fh;
+    mrcHeader header;         // copy with a single blosc thread
+    const mrczChunkEntry *entries;
+    pthread_mutex_t *ioLock;
+    cpu_set_t cpus;           // CPUs of the worker's node
+    int pin;
+    int prefault;
+    int started;
+    uint32_t start, end;      // slice range [start, end)
+    uint8_t *bytesRepr;
+    uint64_t *keys;           // histogram of the worker's slices, if asked for
+    int ret;
+} _numaWorker;
+
+static int _numaNodeCpus( int node, cpu_set_t *cpus )
+{   // Parse /sys/devices/system/node/node<N>/cpulist, e.g. "0-15,32-47".  
+    // Returns 0 if the node exists, or -1.
+    char path[64], list[1024], *token, *save = NULL;
+    FILE *fh;
+    int first, last;
+
+    snprintf( path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node );
+    fh = fopen( path, "r" );
+    if( fh == NULL )
+        return -1;
+    if( fgets( list, sizeof(list), fh ) == NULL )
+        list[0] = '\0';
+    fclose( fh );
+
+    CPU_ZERO( cpus );
+    for( token = strtok_r( list, ",\n", &save ); token != NULL; token = strtok_r( NULL, ",\n", &save ) )
+    {
+        if( sscanf( token, "%d-%d", &first, &last ) == 1 )
+            last = first;
+        for( int c = first; c <= last && c < CPU_SETSIZE; c++ )
+            CPU_SET( c, cpus );
+    }
+    return 0;
+}
+
+static void* _numaWorkerMain( void *arg )
+{
+    _numaWorker *w = (_numaWorker*)arg;
+    mrczReader *reader;
+    size_t sliceBytes;
+
+    if( w->pin )
+        pthread_setaffinity_np( pthread_self(), sizeof(w->cpus), &w->cpus );
+    reader = mrczReader_new( w->fh, &w->header );
+    reader->entries = w->entries;
+    reader->ioLock = w->ioLock;
+    _mrczReader_seek( reader, w->start, 0 );
+    sliceBytes = reader->sliceBytes;
+
+    if( w->prefault )
+    {   // Touch the range from this node rather than from the allocating thread
+        for( size_t i = (size_t)w->start*sliceBytes; i < (size_t)w->end*sliceBytes; i += 4096 )
+            w->bytesRepr[i] = 0;
+    }
+    w->ret = 0;
+    for( uint32_t k = w->start; k < w->end && w->ret == 0; k++ )
+    {
+        w->ret = mrczReader_readSlice( reader, &w->bytesRepr[k*sliceBytes] );
+        if( w->keys != NULL )
+            _histogramSlice( w->keys, w->header.mrcType, &w->bytesRepr[k*sliceBytes], 
+                             sliceBytes / mrcHeader_itemsize( &w->header ) );
+    }
+    mrczReader_free( reader );
+    return NULL;
+}
+
+int _decompressNUMA( FILE *fh, mrcHeader *header, uint8_t *bytesRepr, int prefault )
+{   // Decode slices in parallel.  The z-axis is cut into one contiguous range 
+    // per NUMA node (in node order), each sub-divided between threads pinned 
+    // to that node, so that every slice is first-touched (and hence placed) on 
+    // the node that decoded it.  Downstream code that splits the stack the 
+    // same way gets node-local memory.  Cuts fall on keyframes for 
+    // MRCZ_FLAG_DELTA.  Returns 0 on success, or -1.
+    uint32_t dz = header->dimensions[2];
+    uint32_t keyframes = (header->mrczFlags & MRCZ_FLAG_DELTA) ? (uint32_t)_keyframeInterval( header ) : 1;
+    mrczChunkEntry *entries = NULL;
+    int64_t trailerStart;
+    int nNodes = 0, perNode, nWorkers, ret = 0;
+    cpu_set_t cpus;
+    _numaWorker *workers;
+    pthread_mutex_t ioLock;
+
+    while( _numaNodeCpus( nNodes, &cpus ) == 0 )
+        nNodes++;
+    if( _loadChunkIndex( fh, header, &entries, &trailerStart ) != 0 )
+        return -1;
+
+    perNode = header->blosc_threads / (nNodes > 0 ? nNodes : 1);
+    if( perNode < 1 )
+        perNode = 1;
+    nWorkers = perNode * (nNodes > 0 ? nNodes : 1);
+    workers = calloc( nWorkers, sizeof(_numaWorker) );
+    pthread_mutex_init( &ioLock, NULL );
+#ifndef NDEBUG
+    printf( "DEBUG: decoding %u slices on %d NUMA nodes with %d threads each\n", dz, nNodes, perNode );
+#endif
+
+    for( int i = 0; i < nWorkers; i++ )
+    {
+        _numaWorker *w = &workers[i];
+        w->fh = fh;
+        w->header = *header;
+        w->header.blosc_threads = 1;
+        w->entries = entries;
+        w->ioLock = &ioLock;
+        w->pin = nNodes > 1 && _numaNodeCpus( i / perNode, &w->cpus ) == 0;
+        w->prefault = prefault;
+        w->start = (uint32_t)((uint64_t)dz * i / nWorkers / keyframes * keyframes);
+        w->end = (uint32_t)((uint64_t)dz * (i+1) / nWorkers / keyframes * keyframes);
+        if( i == nWorkers-1 )
+            w->end = dz;
+        w->bytesRepr = bytesRepr;
+        if( header->histogram != NULL )
+            w->keys = calloc( MRCZ_HISTOGRAM_KEYS, sizeof(uint64_t) );
+        w->started = pthread_create( &w->thread, NULL, _numaWorkerMain, w ) == 0;
+        if( !w->started )
+            _numaWorkerMain( w );
+    }
+    for( int i = 0; i < nWorkers; i++ )
+    {
+        if( workers[i].started )
+            pthread_join( workers[i].thread, NULL );
+        if( workers[i].ret != 0 )
+            ret = -1;
+        if( workers[i].keys != NULL )
+        {   // Merge the per-thread histograms
+            for( uint32_t k = 0; k < MRCZ_HISTOGRAM_KEYS; k++ )
+                header->histogram->keys[k] += workers[i].keys[k];
+            free( workers[i].keys );
+        }
+    }
+
+    pthread_mutex_destroy( &ioLock );
+    free( workers );
+    free( entries );
+    return ret;
+}
+#endif
+
+int _compressMRCZ( FILE *fh, mrcVolume *source )
+{
+    int ret = 0;
+    uint32_t dz = source->header->dimensions[2];
+    uint8_t *bytesRepr = (uint8_t*)mrcVolume_data(source);
+    mrczWriter *writer = mrczWriter_new( fh, source->header );
+    mrczHistogram *histogram = source->header->histogram;
+
+    if( histogram != NULL )
+        _histogramStart( histogram, source->header );
+    for( uint32_t k = 0; k < dz && ret == 0; k++ )
+    {
+        if( histogram != NULL )
+            _histogramSlice( histogram->keys, source->header->mrcType, &bytesRepr[k*writer->sliceBytes],
+                             writer->sliceBytes / mrcHeader_itemsize( source->header ) );
+        ret = mrczWriter_writeSlice( writer, &bytesRepr[k*writer->sliceBytes] );
+    }
+
+    if( mrczWriter_free( writer ) != 0 )
+        ret = -1;
+    if( ret == 0 && histogram != NULL )
+        _histogramFinish( histogram );
+    return ret;
+}
+
+int _loadChunkIndex( FILE *fh, mrcHeader *header, mrczChunkEntry **entries, int64_t *trailerStart )
+{   // Build the chunk index of a compressed file: from the trailer when there 
+    // is one, otherwise by hopping over the 16-byte blosc headers (in which 
+    // case the crc32c fields are zero).  *trailerStart is set to the end of 
+    // the last chunk.  Returns 0 on success, or -1.
+    uint8_t tail[MRCZ_TRAILER_TAIL_LEN];
+    uint8_t bloscHeader[BLOSC_MIN_HEADER_LENGTH];
+    uint32_t dz = header->dimensions[2], cbytes;
+    int64_t pos = MRC_HEADER_LEN + header->extendedHeaderSize;
+    mrczSection section;
+
+    *entries = calloc( dz, sizeof(mrczChunkEntry) );
+    if( _findSection( fh, MRCZ_SECTION_CHUNKINDEX, &section ) == 0 && section.count == dz
+        && fread( *entries, sizeof(mrczChunkEntry), dz, fh ) == dz )
+    {
+        fseek( fh, -MRCZ_TRAILER_TAIL_LEN, SEEK_END );
+        if( fread( tail, sizeof(uint8_t), MRCZ_TRAILER_TAIL_LEN, fh ) == MRCZ_TRAILER_TAIL_LEN )
+        {
+            memcpy( trailerStart, &tail[0], sizeof(*trailerStart) );
+            return 0;
+        }
+    }
+
+    // No usable index, so walk the chunks
+    for( uint32_t k = 0; k < dz; k++ )
+    {
+        if( fseek( fh, pos, SEEK_SET ) != 0 
+            || fread( bloscHeader, sizeof(uint8_t), BLOSC_MIN_HEADER_LENGTH, fh ) != BLOSC_MIN_HEADER_LENGTH )
+        {
+            printf( "Error: _loadChunkIndex found only %u of %u chunks in %s\n", k, dz, header->metaname );
+            free( *entries );
+            *entries = NULL;
+            return -1;
+        }
+        memcpy( &cbytes, &bloscHeader[12], sizeof(cbytes) );
+        (*entries)[k].offset = pos;
+        (*entries)[k].cbytes = cbytes;
+        pos += cbytes;
+    }
+    *trailerStart = pos;
+    return 0;
+}
+
+void _accumulateStats( const void *data, int32_t mrcType, size_t n, double *min, double *max, 
+                       double *sum, double *sumsq )
+{   // Running min/max/sum/sum-of-squares over n items, for the header stats.
+    // Complex data is skipped.
+    double val;
+    size_t i = 0;
+#if defined(MRCZ_HAVE_SSE2)
+    if( mrcType == MRC_FLOAT32 && n >= 4 )
+    {   // One pass with min/max in single and the sums in double precision
+        const float *f = (const float*)data;
+        __m128 vmin = _mm_loadu_ps( f ), vmax = vmin;
+        __m128d s0 = _mm_setzero_pd(), s1 = s0, q0 = s0, q1 = s0;
+        float lanes[8];
+        double sums[4];
+        for( ; i + 4 <= n; i += 4 )
+        {
+            __m128 x = _mm_loadu_ps( &f[i] );
+            __m128d lo = _mm_cvtps_pd( x ), hi = _mm_cvtps_pd( _mm_movehl_ps( x, x ) );
+            vmin = _mm_min_ps( vmin, x );
+            vmax = _mm_max_ps( vmax, x );
+            s0 = _mm_add_pd( s0, lo );
+            s1 = _mm_add_pd( s1, hi );
+            q0 = _mm_add_pd( q0, _mm_mul_pd( lo, lo ) );
+            q1 = _mm_add_pd( q1, _mm_mul_pd( hi, hi ) );
+        }
+        _mm_storeu_ps( &lanes[0], vmin );
+        _mm_storeu_ps( &lanes[4], vmax );
+        for( int j = 0; j < 4; j++ )
+        {
+            if( lanes[j] < *min ) *min = lanes[j];
+            if( lanes[4+j] > *max ) *max = lanes[4+j];
+        }
+        _mm_storeu_pd( &sums[0], _mm_add_pd( s0, s1 ) );
+        _mm_storeu_pd( &sums[2], _mm_add_pd( q0, q1 ) );
+        *sum += sums[0] + sums[1];
+        *sumsq += sums[2] + sums[3];
+    }
+#endif
+    for( ; i < n; i++ )
+    {
+        switch( mrcType )
+        {
+            case MRC_INT8:
+                val = ((int8_t*)data)[i];
+                break;
+            case MRC_INT16:
+                val = ((int16_t*)data)[i];
+                break;
+            case MRC_FLOAT32:
+                val = ((float*)data)[i];
+                break;
+            case MRC_UINT16:
+                val = ((uint16_t*)data)[i];
+                break;
+            default:
+                return;
+        }
+        if( val < *min ) *min = val;
+        if( val > *max ) *max = val;
+        *sum += val;
+        *sumsq += val*val;
+    }
+}
+
+void _histogramSlice( uint64_t *keys, int32_t mrcType, const void *data, size_t n )
+{   // Count n values into the MRCZ_HISTOGRAM_KEYS keys of an mrczHistogram.  
+    // SSE2 computes the keys of a vector of values at once, the counting is 
+    // scalar.  Integers are offset to be unsigned, and float32 bits are made 
+    // to sort like their values (sign bit set for positive numbers, all bits 
+    // flipped for negative ones) and cut to the top 16.
+    size_t i = 0;
+    switch( mrcType )
+    {
+        case MRC_INT8:
+            for( ; i < n; i++ )
+                keys[((const uint8_t*)data)[i] ^ 0x80]++;
+            break;
+        case MRC_INT16:
+        case MRC_UINT16:
+        {
+            const uint16_t *src = (const uint16_t*)data;
+            uint16_t bias = mrcType == MRC_INT16 ? 0x8000 : 0;
+#if defined(MRCZ_HAVE_SSE2)
+            __m128i vbias = _mm_set1_epi16( (short)bias );
+            uint16_t lanes[8];
+            for( ; i + 8 <= n; i += 8 )
+            {
+                _mm_storeu_si128( (__m128i*)lanes, _mm_xor_si128( _mm_loadu_si128( (const __m128i*)&src[i] ), vbias ) );
+                for( int j = 0; j < 8; j++ )
+                    keys[lanes[j]]++;
+            }
+#endif
+            for( ; i < n; i++ )
+                keys[src[i] ^ bias]++;
+            break;
+        }
+        case MRC_FLOAT32:
+        {
+            const uint32_t *src = (const uint32_t*)data;
+#if defined(MRCZ_HAVE_SSE2)
+            __m128i sign = _mm_set1_epi32( (int)0x80000000u );
+            uint32_t lanes[4];
+            for( ; i + 4 <= n; i += 4 )
+            {
+                __m128i x = _mm_loadu_si128( (const __m128i*)&src[i] );
+                __m128i flip = _mm_or_si128( _mm_srai_epi32( x, 31 ), sign );
+                _mm_storeu_si128( (__m128i*)lanes, _mm_srli_epi32( _mm_xor_si128( x, flip ), 16 ) );
+                keys[lanes[0]]++;
+                keys[lanes[1]]++;
+                keys[lanes[2]]++;
+                keys[lanes[3]]++;
+            }
+#endif
+            for( ; i < n; i++ )
+                keys[(src[i] ^ ((uint32_t)((int32_t)src[i] >> 31) | 0x80000000u)) >> 16]++;
+            break;
+        }
+    }
+}
+
+static void _histogramKeyRange( mrczHistogram *self, uint32_t key, double *lo, double *hi )
+{   // The values counted under key
+    if( self->mrcType == MRC_FLOAT32 )
+    {
+        uint32_t bits[2] = { key << 16, (key << 16) | 0xFFFF };
+        float values[2];
+        for( int j = 0; j < 2; j++ )
+        {
+            bits[j] = (bits[j] & 0x80000000u) ? bits[j] ^ 0x80000000u : ~bits[j];
+            memcpy( &values[j], &bits[j], sizeof(float) );
+        }
+        *lo = values[0];
+        *hi = values[1];
+        return;
+    }
+    *lo = self->mrcType == MRC_INT8 ? (double)key - 128.0 
+        : self->mrcType == MRC_INT16 ? (double)key - 32768.0 : (double)key;
+    *lo = *lo * self->scale + self->offset;
+    *hi = *lo;
+}
+
+static void _histogramKeys( mrczHistogram *self, uint32_t *first, uint32_t *last )
+{   // The range of keys of finite values, from the lowest value up
+    *first = 0;
+    *last = self->mrcType == MRC_INT8 ? 0xFF : MRCZ_HISTOGRAM_KEYS - 1;
+    if( self->mrcType == MRC_FLOAT32 )
+    {   // Beyond are the infinities and NaNs
+        *first = 0x0080;
+        *last = 0xFF7F;
+    }
+}
+
+void _histogramStart( mrczHistogram *self, mrcHeader *header )
+{   // Clear the counts for a new volume of header->mrcType
+    self->mrcType = header->mrcType;
+    self->scale = 1.0;
+    self->offset = 0.0;
+    if( header->mrcType != MRC_FLOAT32 && (header->mrczFlags & MRCZ_FLAG_QUANTIZED) && header->dequantize )
+    {
+        self->scale = header->quantScale;
+        self->offset = header->quantOffset;
+    }
+    if( self->keys == NULL )
+        self->keys = malloc( MRCZ_HISTOGRAM_KEYS * sizeof(uint64_t) );
+    memset( self->keys, 0, MRCZ_HISTOGRAM_KEYS * sizeof(uint64_t) );
+}
+
+void _histogramFinish( mrczHistogram *self )
+{   // Fill in the total, the data range and the bins from the key counts
+    uint32_t first, last;
+    double lo, hi, binLo, binHi, width;
+    int64_t bin;
+
+    _histogramKeys( self, &first, &last );
+    self->total = 0;
+    self->min = self->max = 0.0;
+    memset( self->counts, 0, self->nBins * sizeof(uint64_t) );
+    while( first <= last && self->keys[first] == 0 )
+        first++;
+    while( last > first && self->keys[last] == 0 )
+        last--;
+    if( first > last || self->mrcType == MRC_COMPLEX64 )
+        return;
+
+    _histogramKeyRange( self, first, &self->min, &hi );
+    _histogramKeyRange( self, last, &lo, &self->max );
+    if( self->scale < 0.0 )
+    {
+        double swap = self->min;
+        self->min = self->max;
+        self->max = swap;
+    }
+    binLo = self->lo < self->hi ? self->lo : self->min;
+    binHi = self->lo < self->hi ? self->hi : self->max;
+    width = binHi > binLo ? (binHi - binLo) / self->nBins : 0.0;
+    for( uint32_t k = first; k <= last; k++ )
+    {
+        if( self->keys[k] == 0 )
+            continue;
+        _histogramKeyRange( self, k, &lo, &hi );
+        bin = width > 0.0 ? (int64_t)floor( (0.5 * (lo + hi) - binLo) / width ) : 0;
+        bin = bin < 0 ? 0 : (bin >= self->nBins ? self->nBins - 1 : bin);
+        self->counts[bin] += self->keys[k];
+        self->total += self->keys[k];
+    }
+}
+
+mrczHistogram* mrczHistogram_new( int32_t nBins )
+{
+    mrczHistogram *self = calloc( 1, sizeof(*self) );
+    self->nBins = nBins > 0 ? nBins : MRCZ_DEFAULT_BINS;
+    self->counts = calloc( self->nBins, sizeof(uint64_t) );
+    self->scale = 1.0;
+    return self;
+}
+
+double mrczHistogram_percentile( mrczHistogram *self, double percent )
+{   // Walk the keys up to the rank, interpolating within the key for float32.  
+    // A negative quantScale runs the keys in reverse order of value.
+    uint32_t first, last;
+    uint64_t below = 0;
+    double rank, lo, hi;
+
+    if( self->keys == NULL || self->total == 0 )
+        return 0.0;
+    if( self->scale < 0.0 )
+        percent = 100.0 - percent;
+    rank = (percent < 0.0 ? 0.0 : percent > 100.0 ? 100.0 : percent) / 100.0 * self->total;
+    _histogramKeys( self, &first, &last );
+    for( uint32_t k = first; k <= last; k++ )
+    {
+        uint64_t count = self->keys[k];
+        if( count == 0 || (double)(below + count) < rank )
+        {
+            below += count;
+            continue;
+        }
+        _histogramKeyRange( self, k, &lo, &hi );
+        return lo + (hi - lo) * (rank - below) / count;
+    }
+    return self->scale < 0.0 ? self->min : self->max;
+}
+
+void mrczHistogram_free( mrczHistogram *self )
+{
+    if( self == NULL )
+        return;
+    free( self->counts );
+    free( self->keys );
+    free( self );
+}
+
+
+
+/*
+  MRCZ library public functions
+*/ 
+//Consider overloaded readMRCZ( char *filename, mrcVolume *dest ) that opens the file.
+
+int readMRCZHeader( FILE *fh, mrcHeader *header, char *name_for_metadata )
+{   // Read and parse only the 1024-byte standard header, leaving fh at the start 
+    // of the extended header.  No data is read.  Returns 0 on success.
+    uint8_t headerBytes[MRC_HEADER_LEN];
+    size_t fread_ret;
+
+    fread_ret = fread( (void *)headerBytes, sizeof(uint8_t), MRC_HEADER_LEN, fh );
+    if( fread_ret != MRC_HEADER_LEN )
+    {
+        printf( "Error: failed to read 1024-bytes from header of %s, read %lu bytes\n", name_for_metadata, fread_ret );
+        return -1;
+    }
+    return _parseStandardHeader( headerBytes, header, name_for_metadata );
+}
+
+int readMRCZ( FILE *fh, mrcVolume *dest, char *name_for_metadata )
+{   // Read from a file handle and then write to an address mrcVolume struct, dest.
+    // filename is optional and will be saved into the associated dest->header->filename.
+    int fread_ret;
+    mrcHeader *header;
+    uint8_t *dictionary = NULL;
+    
+    // Re-use the header from mrcVolume_new() rather than leaking it.
+    if( dest->header == NULL )
+        dest->header = mrcHeader_new();
+    header = dest->header;
+
+    if( readMRCZHeader( fh, header, name_for_metadata ) != 0 )
+    {
+        return 0;
+    }
+    fread_ret = MRC_HEADER_LEN;
+
+    // Skip the extended header, without seeking back for a dictionary in it
+    // TODO: read other extended header information if desired
+    if( _skipExtendedHeader( fh, header, (header->mrczFlags & MRCZ_FLAG_DICTIONARY) 
+                                         && header->dictionary == NULL ? &dictionary : NULL ) != 0 )
+        return 0;
+    if( dictionary != NULL )
+    {
+        header->dictionary = dictionary;
+        header->dictionarySize = header->extendedHeaderSize;
+    }
+
+    // Branch into compressed or uncompressed implementations
+    if( header->blosc_compressor > 0 )
+    {   // Compressed data
+        if( _decompressMRCZ( fh, dest ) < 0 )
+            fread_ret = 0;
+    }
+    else
+    {   // Uncompressed data
+        fread_ret = _loadUncompressedMRC( fh, dest );
+    }
+    if( dictionary != NULL )
+    {
+        header->dictionary = NULL;
+        free( dictionary );
+    }
+    if( fread_ret == 0 )
+        return 0;
+    if( header->dequantize && fread_ret > 0 && _dequantizeVolume( dest ) != 0 )
+        return 0;
+    return fread_ret;
+}
+
+static void _mutexLock( void *mutex )
+{
+#if defined(MRCZ_HAVE_PTHREADS)
+    pthread_mutex_lock( (pthread_mutex_t*)mutex );
+#endif
+}
+
+static void _mutexUnlock( void *mutex )
+{
+#if defined(MRCZ_HAVE_PTHREADS)
+    pthread_mutex_unlock( (pthread_mutex_t*)mutex );
+#endif
+}
+
+static void* _mutexNew( void )
+{
+#if defined(MRCZ_HAVE_PTHREADS)
+    pthread_mutex_t *mutex = malloc( sizeof(pthread_mutex_t) );
+    pthread_mutex_init( mutex, NULL );
+    return mutex;
+#else
+    return NULL;
+#endif
+}
+
+static void _mutexFree( void *mutex )
+{
+#if defined(MRCZ_HAVE_PTHREADS)
+    if( mutex != NULL )
+        pthread_mutex_destroy( (pthread_mutex_t*)mutex );
+#endif
+    free( mutex );
+}
+
+mrcVolume* mrcVolume_open( FILE *fh, char *filename, size_t cacheBytes, int readAhead )
+{
+    mrcVolume *self = mrcVolume_new( NULL, NULL );
+    mrcHeader *header = self->header;
+    mrczSliceCache *cache;
+    uint32_t dz;
+    int64_t trailerStart;
+    size_t sliceBytes;
+
+    if( readMRCZHeader( fh, header, filename ) != 0 || !_validHeader( header ) )
+    {
+        mrcVolume_free( self );
+        return NULL;
+    }
+    dz = header->dimensions[2];
+    sliceBytes = (size_t)header->dimensions[0] * header->dimensions[1] * mrcHeader_itemsize( header );
+
+    cache = self->cache = calloc( 1, sizeof(*cache) );
+    if( header->blosc_compressor != BLOSC_COMPRESSOR_NONE )
+    {
+        if( _loadChunkIndex( fh, header, &cache->entries, &trailerStart ) != 0 )
+        {
+            mrcVolume_free( self );
+            return NULL;
+        }
+    }
+    else
+    {   // Uncompressed slices are at fixed offsets
+        cache->entries = calloc( dz, sizeof(mrczChunkEntry) );
+        for( uint32_t k = 0; k < dz; k++ )
+            cache->entries[k].offset = MRC_HEADER_LEN + header->extendedHeaderSize + (uint64_t)k * sliceBytes;
+    }
+    cache->reader = mrczReader_new( fh, header );
+    cache->reader->entries = cache->entries;
+    _mrczReader_seek( cache->reader, 0, 0 );
+
+    cache->readAhead = readAhead > 0 ? readAhead : 0;
+    cache->nSlots = (int)(cacheBytes / sliceBytes);
+    if( cache->nSlots < cache->readAhead + 2 )
+        cache->nSlots = cache->readAhead + 2;
+    cache->slots = calloc( cache->nSlots, sizeof(mrczCacheSlot) );
+    for( int i = 0; i < cache->nSlots; i++ )
+        cache->slots[i].k = -1;
+    cache->lock = _mutexNew();
+    cache->decodeLock = _mutexNew();
+    return self;
+}
+
+static int _mrczSliceCache_find( mrczSliceCache *self, uint32_t k )
+{   // Slot holding slice k, or -1.  lock must be held.
+    for( int i = 0; i < self->nSlots; i++ )
+    {
+        if( self->slots[i].k == (int64_t)k )
+            return i;
+    }
+    return -1;
+}
+
+int _mrczSliceCache_load( mrczSliceCache *self, uint32_t k, int readAhead )
+{   // Make sure slice k is cached, evicting the least recently used unpinned 
+    // slot.  decodeLock must be held, as only its holder moves slots between 
+    // slices.  Read-ahead is skipped quietly if every slot is pinned.  
+    // Returns the slot, or -1.
+    mrczReader *reader = self->reader;
+    uint32_t keyframe = k;
+    mrczCacheSlot *slot;
+    int victim = -1, ret = 0;
+
+    _mutexLock( self->lock );
+    victim = _mrczSliceCache_find( self, k );
+    if( victim >= 0 )
+    {
+        _mutexUnlock( self->lock );
+        return victim;
+    }
+    for( int i = 0; i < self->nSlots; i++ )
+    {
+        if( self->slots[i].pins == 0 && (victim < 0 || self->slots[i].lastUse < self->slots[victim].lastUse) )
+            victim = i;
+    }
+    if( victim >= 0 )
+        self->slots[victim].k = -1;
+    _mutexUnlock( self->lock );
+    if( victim < 0 )
+    {
+        if( !readAhead )
+            printf( "Error: mrcVolume_slice has every cached slice pinned\n" );
+        return -1;
+    }
+
+    slot = &self->slots[victim];
+    if( slot->data == NULL )
+        slot->data = malloc( reader->sliceBytes );
+    if( reader->prev != NULL )
+    {   // Delta-coded slices are decoded from the last keyframe, unless the 
+        // reader is already on its way to k
+        keyframe = k - k % (uint32_t)_keyframeInterval( reader->header );
+        if( self->discard == NULL )
+            self->discard = malloc( reader->sliceBytes );
+    }
+    if( reader->next < keyframe || reader->next > k )
+        _mrczReader_seek( reader, keyframe, 0 );
+    while( ret == 0 && reader->next < k )
+        ret = mrczReader_readSlice( reader, self->discard );
+    if( ret == 0 )
+        ret = mrczReader_readSlice( reader, slot->data );
+
+    _mutexLock( self->lock );
+    if( ret == 0 )
+    {
+        slot->k = k;
+        slot->lastUse = ++self->clock;
+    }
+    _mutexUnlock( self->lock );
+    return ret == 0 ? victim : -1;
+}
+
+const void* mrcVolume_slice( mrcVolume *self, uint32_t k )
+{
+    mrczSliceCache *cache = self->cache;
+    uint32_t dz;
+    int s;
+
+    if( cache == NULL || k >= (uint32_t)self->header->dimensions[2] )
+        return NULL;
+    dz = self->header->dimensions[2];
+
+    _mutexLock( cache->lock );
+    s = _mrczSliceCache_find( cache, k );
+    if( s >= 0 )
+    {
+        cache->slots[s].pins++;
+        cache->slots[s].lastUse = ++cache->clock;
+        _mutexUnlock( cache->lock );
+        return cache->slots[s].data;
+    }
+    _mutexUnlock( cache->lock );
+
+    _mutexLock( cache->decodeLock );
+    s = _mrczSliceCache_load( cache, k, 0 );
+    if( s >= 0 )
+    {
+        _mutexLock( cache->lock );
+        cache->slots[s].pins++;
+        _mutexUnlock( cache->lock );
+        for( uint32_t j = k+1; j <= k + (uint32_t)cache->readAhead && j < dz; j++ )
+            _mrczSliceCache_load( cache, j, 1 );
+    }
+    _mutexUnlock( cache->decodeLock );
+    return s >= 0 ? cache->slots[s].data : NULL;
+}
+
+void mrcVolume_releaseSlice( mrcVolume *self, uint32_t k )
+{
+    mrczSliceCache *cache = self->cache;
+    int s;
+
+    if( cache == NULL )
+        return;
+    _mutexLock( cache->lock );
+    s = _mrczSliceCache_find( cache, k );
+    if( s >= 0 && cache->slots[s].pins > 0 )
+        cache->slots[s].pins--;
+    _mutexUnlock( cache->lock );
+}
+
+void _mrczSliceCache_free( mrczSliceCache *self )
+{
+    if( self->reader != NULL )
+        mrczReader_free( self->reader );
+    for( int i = 0; i < self->nSlots; i++ )
+        free( self->slots[i].data );
+    free( self->slots );
+    free( self->entries );
+    free( self->discard );
+    _mutexFree( self->lock );
+    _mutexFree( self->decodeLock );
+    free( self );
+}
+
+size_t peekMRCZ( FILE *fh, mrcHeader *header, char *name_for_metadata )
+{   // Parse the header and return the size in bytes of the decompressed data, 
+    // so that a buffer can be made for readMRCZ_into().  The file position is 
+    // left where it was.  Returns 0 on failure.
+    long pos = ftell( fh );
+    int ret = readMRCZHeader( fh, header, name_for_metadata );
+
+    fseek( fh, pos, SEEK_SET );
+    if( ret != 0 || !_validHeader( header ) )
+        return 0;
+    return (size_t)header->dimensions[0] * header->dimensions[1] * header->dimensions[2] 
+           * mrcHeader_itemsize( header );
+}
+
+int readMRCZ_into( FILE *fh, mrcHeader *header, void *buf, size_t bufsize )
+{   // Read a whole file into the caller's buffer, with no allocation of the 
+    // volume.  header must be initialized (e.g. by mrcHeader_new) and its 
+    // blosc_threads and numaAware are used for decoding.  fh must be at the 
+    // start of the file.  Returns 0 on success, or -1.
+    size_t nbytes = peekMRCZ( fh, header, header->metaname );
+
+    if( nbytes == 0 )
+    {
+        printf( "Error: readMRCZ_into could not parse the header of %s\n", header->metaname );
+        return -1;
+    }
+    if( bufsize < nbytes )
+    {
+        printf( "Error: readMRCZ_into needs %lu bytes but the buffer holds %lu\n", 
+                (unsigned long)nbytes, (unsigned long)bufsize );
+        return -1;
+    }
+    fseek( fh, MRC_HEADER_LEN + header->extendedHeaderSize, SEEK_SET );
+    return _decompressInto( fh, header, (uint8_t*)buf, 0 );
+}
+
+int readMRCZ_level( FILE *fh, mrcVolume *dest, int level, char *name_for_metadata )
+{   // Read overview level (0 for the full volume) of a file written with 
+    // pyramidLevels, into dest like readMRCZ.  dest->header takes the shape 
+    // of the level, with the sampling (mGrid) scaled to match, and its 
+    // pyramidLevels is set to the number of levels in the file.  Only the 
+    // chunks of that level are read.  Returns 0 on success, or -1.
+    mrczSection section;
+    mrczPyramidLevel levels[MRCZ_MAX_PYRAMID_LEVELS];
+    mrczChunkEntry *entries;
+    mrcHeader *header;
+    uint8_t *bloscRepr = NULL, *bytesRepr;
+    size_t bloscCapacity = 0, sliceBytes;
+    int64_t skip = 0;
+    int ret = 0;
+
+    if( level == 0 )
+        return readMRCZ( fh, dest, name_for_metadata ) ? 0 : -1;
+    if( dest->header == NULL )
+        dest->header = mrcHeader_new();
+    header = dest->header;
+    if( readMRCZHeader( fh, header, name_for_metadata ) != 0 )
+        return -1;
+    if( header->blosc_compressor == BLOSC_COMPRESSOR_NONE || _swapWidth( header ) != 0
+        || _findSection( fh, MRCZ_SECTION_PYRAMID, &section ) != 0 
+        || section.count > MRCZ_MAX_PYRAMID_LEVELS
+        || fread( levels, sizeof(mrczPyramidLevel), section.count, fh ) != section.count )
+    {
+        printf( "Error: %s has no readable pyramid\n", name_for_metadata );
+        return -1;
+    }
+    header->pyramidLevels = section.count;
+    if( level < 0 || level > (int)section.count )
+    {
+        printf( "Error: %s has pyramid levels 1 to %u, not %d\n", name_for_metadata, section.count, level );
+        return -1;
+    }
+    for( int L = 1; L < level; L++ )
+        skip += levels[L-1].dimensions[2] * sizeof(mrczChunkEntry);
+    fseek( fh, skip, SEEK_CUR );
+
+    for( int i = 0; i < 3; i++ )
+    {
+        if( header->mGrid[i] > 0 )
+            header->mGrid[i] = (int32_t)(((int64_t)header->mGrid[i] * levels[level-1].dimensions[i] 
+                                          + header->dimensions[i] - 1) / header->dimensions[i]);
+        header->dimensions[i] = levels[level-1].dimensions[i];
+    }
+    entries = malloc( header->dimensions[2] * sizeof(mrczChunkEntry) );
+    if( fread( entries, sizeof(mrczChunkEntry), header->dimensions[2], fh ) != (size_t)header->dimensions[2] )
+    {
+        printf( "Error: pyramid index of %s is truncated\n", name_for_metadata );
+        free( entries );
+        return -1;
+    }
+
+    sliceBytes = (size_t)header->dimensions[0] * header->dimensions[1] * mrcHeader_itemsize( header );
+    bytesRepr = _mrcVolume_alloc( dest, sliceBytes * header->dimensions[2] );
+    for( int32_t k = 0; k < header->dimensions[2] && ret == 0; k++ )
+    {
+        int cbytes;
+        fseek( fh, entries[k].offset, SEEK_SET );
+        cbytes = _readChunk( fh, &bloscRepr, &bloscCapacity );
+        if( cbytes != (int)entries[k].cbytes || _crc32c( 0, bloscRepr, cbytes ) != entries[k].crc32c
+            || blosc_decompress_ctx( bloscRepr, &bytesRepr[k * sliceBytes], sliceBytes, 
+                                     header->blosc_threads ) != (int)sliceBytes )
+        {
+            printf( "Error: %s pyramid level %d slice %d is corrupt\n", name_for_metadata, level, k );
+            ret = -1;
+        }
+    }
+    free( bloscRepr );
+    free( entries );
+    if( ret == 0 && header->dequantize && _dequantizeVolume( dest ) != 0 )
+        ret = -1;   // as readMRCZ does for level 0
+    return ret;
+}
+
+static void _scanWorker( void *arg, int64_t index )
+{
+    mrczFileInfo *info = &((mrczFileInfo*)arg)[index];
+    struct stat st;
+    FILE *fh;
+
+    info->status = -1;
+    fh = fopen( info->filename, "rb" );
+    if( fh == NULL )
+        return;
+    if( fstat( fileno(fh), &st ) == 0 )
+        info->fileBytes = (int64_t)st.st_size;
+    if( readMRCZHeader( fh, &info->header, info->filename ) == 0 && _validHeader( &info->header ) )
+    {
+        info->rawBytes = (int64_t)info->header.dimensions[0] * info->header.dimensions[1] 
+                       * info->header.dimensions[2] * mrcHeader_itemsize( &info->header );
+        info->dataBytes = info->fileBytes - MRC_HEADER_LEN - info->header.extendedHeaderSize;
+        info->status = 0;
+    }
+    fclose( fh );
+}
+
+int scanMRCZ( mrczFileInfo *infos, int nFiles, int n_threads )
+{   // Read only the headers of nFiles files in parallel.  Each infos[i].filename 
+    // must be set by the caller, the remaining fields are filled in.  Returns 
+    // the number of files that parsed as valid MRC/MRCZ.
+    int nValid = 0;
+
+    if( n_threads <= 0 )
+        n_threads = getNumCPU();
+    _parallelFor( nFiles, n_threads, _scanWorker, (void*)infos );
+    for( int i = 0; i < nFiles; i++ )
+    {
+        if( infos[i].status == 0 )
+            nValid++;
+    }
+    return nValid;
+}
+
+int _writeHeader( FILE *fh, mrcHeader *header )
+{   // Write the standard header, and the zstd dictionary as the extended header 
+    // if there is one, and leave fh at the start of the data.
+    int fh_dataStartPos;
+    uint8_t headerBytes[MRC_HEADER_LEN] = {0};
+
+    if( _hasDictionary( header ) )
+        header->extendedHeaderSize = header->dictionarySize;
+    fh_dataStartPos = MRC_HEADER_LEN + header->extendedHeaderSize;
+    _buildStandardHeader( header, headerBytes );
+
+    // TODO: handle writing other extended headers
+    if( fwrite( headerBytes, sizeof(uint8_t), MRC_HEADER_LEN, fh ) != MRC_HEADER_LEN )
+        return -1;
+    if( _hasDictionary( header ) )
+    {
+        size_t size = (size_t)header->dictionarySize;
+        return fwrite( header->dictionary, sizeof(uint8_t), size, fh ) == size ? 0 : -1;
+    }
+#ifndef NDEBUG
+    printf( "DEBUG: zeroing up to %i in order to write data.\n", fh_dataStartPos );
+#endif
+    // Zeros rather than a seek, so that fh may be a pipe
+    for( int i = MRC_HEADER_LEN; i < fh_dataStartPos; i++ )
+    {
+        if( fputc( 0, fh ) == EOF )
+            return -1;
+    }
+    return 0;
+}
+
+int _skipExtendedHeader( FILE *fh, mrcHeader *header, uint8_t **extended )
+{   // Move fh from the end of the standard header to the start of the data, by 
+    // seeking or, on a pipe, by reading.  With extended, the extended header 
+    // is read and returned in a buffer for the caller to free (NULL if there 
+    // is none).  Returns 0 on success, or -1.
+    size_t size = header->extendedHeaderSize > 0 ? (size_t)header->extendedHeaderSize : 0;
+    uint8_t *buffer;
+
+    if( extended != NULL )
+        *extended = NULL;
+    if( extended == NULL && fseek( fh, MRC_HEADER_LEN + size, SEEK_SET ) == 0 )
+        return 0;
+    if( size == 0 )
+        return 0;
+    buffer = malloc( size );
+    if( fread( buffer, sizeof(uint8_t), size, fh ) != size )
+    {
+        printf( "Error: could not read the extended header of %s\n", header->metaname );
+        free( buffer );
+        return -1;
+    }
+    if( extended != NULL )
+        *extended = buffer;
+    else
+        free( buffer );
+    return 0;
+}
+
+int _writeQuantized( FILE *fh, mrcHeader *header, const float *data )
+{   // writeMRCZ of float32 data quantized to header->quantizedType.  With 
+    // quantScale given, the statistics are gathered slice by slice in the 
+    // loop that quantizes and compresses, and patched into the header at the 
+    // end, so the data is passed over once.  Automatic scaling, or a stream 
+    // that cannot seek back to the header, needs a pass for the range first.  
+    // Returns 0 on success, or -1.
+    mrcHeader stored;
+    mrczWriter *writer;
+    uint8_t headerBytes[MRC_HEADER_LEN];
+    size_t sliceItems = (size_t)header->dimensions[0] * header->dimensions[1];
+    size_t n = sliceItems * header->dimensions[2];
+    double min = HUGE_VAL, max = -HUGE_VAL, sum = 0.0, sumsq = 0.0, mean, var;
+    long start = header->quantScale != 0.0f ? ftell( fh ) : -1, end;
+    int ret = 0;
+
+    if( start < 0 )
+        _accumulateStats( data, MRC_FLOAT32, n, &min, &max, &sum, &sumsq );
+    if( _quantizedHeader( header, &stored, start < 0 ? min : header->min, start < 0 ? max : header->max ) != 0 )
+        return -1;
+    if( start < 0 )
+    {
+        mean = n > 0 ? sum / n : 0.0;
+        var = n > 0 ? sumsq / n - mean * mean : 0.0;
+        stored.mean = (float)((mean - stored.quantOffset) / stored.quantScale);
+        stored.std = (float)(sqrt( var > 0.0 ? var : 0.0 ) / fabs( stored.quantScale ));
+    }
+
+    if( _writeHeader( fh, &stored ) != 0 )
+        return -1;
+    writer = mrczWriter_new( fh, &stored );
+    if( writer == NULL )
+        return -1;
+    if( header->histogram != NULL )
+        _histogramStart( header->histogram, header );
+    for( int32_t k = 0; k < stored.dimensions[2] && ret == 0; k++ )
+    {
+        if( start >= 0 )
+            _accumulateStats( &data[k * sliceItems], MRC_FLOAT32, sliceItems, &min, &max, &sum, &sumsq );
+        if( header->histogram != NULL )
+            _histogramSlice( header->histogram->keys, MRC_FLOAT32, &data[k * sliceItems], sliceItems );
+        ret = mrczWriter_writeFloatSlice( writer, &data[k * sliceItems] );
+    }
+    if( mrczWriter_free( writer ) != 0 )
+        ret = -1;
+    if( ret == 0 && start >= 0 )
+    {   // The statistics of the slices just written, in stored units
+        mean = n > 0 ? sum / n : 0.0;
+        var = n > 0 ? sumsq / n - mean * mean : 0.0;
+        stored.min = (float)((min - stored.quantOffset) / stored.quantScale);
+        stored.max = (float)((max - stored.quantOffset) / stored.quantScale);
+        stored.mean = (float)((mean - stored.quantOffset) / stored.quantScale);
+        stored.std = (float)(sqrt( var > 0.0 ? var : 0.0 ) / fabs( stored.quantScale ));
+        _buildStandardHeader( &stored, headerBytes );
+        end = ftell( fh );
+        if( end < 0 || fseek( fh, start, SEEK_SET ) != 0 
+            || fwrite( headerBytes, sizeof(uint8_t), MRC_HEADER_LEN, fh ) != MRC_HEADER_LEN 
+            || fseek( fh, end, SEEK_SET ) != 0 )
+        {
+            printf( "Error: could not update the statistics in the header\n" );
+            ret = -1;
+        }
+    }
+    if( ret == 0 && fflush( fh ) != 0 )
+        ret = -1;
+    if( ret == 0 && header->histogram != NULL )
+        _histogramFinish( header->histogram );
+    return ret;
+}
+
+int writeMRCZ( FILE *fh, mrcVolume *vol )
+{   // Returns 0 on success, or -1 if the header, the data or the trailer 
+    // could not be written, which includes flushing them to fh
+    void *dataPtr;
+    size_t dsize;
+    int ret;
+    
+    if( vol->header->mrcType == MRC_FLOAT32 && (vol->header->mrczFlags & MRCZ_FLAG_QUANTIZED) )
+        return _writeQuantized( fh, vol->header, (const float*)mrcVolume_data( vol ) );
+    if( vol->header->mrcType == MRC_FLOAT32 && vol->header->detectIntegers )
+    {   // Whole numbers are stored losslessly in the smallest integer type
+        mrcHeader integers;
+        memcpy( &integers, vol->header, sizeof(integers) );
+        integers.quantizedType = _detectIntegerType( vol->header, (const float*)mrcVolume_data( vol ) );
+        if( integers.quantizedType >= 0 )
+        {
+            integers.mrczFlags |= MRCZ_FLAG_QUANTIZED;
+            integers.quantScale = 1.0f;
+            integers.quantOffset = 0.0f;
+            return _writeQuantized( fh, &integers, (const float*)mrcVolume_data( vol ) );
+        }
+    }
+    if( (vol->header->mrczFlags & MRCZ_FLAG_DICTIONARY) && vol->header->dictionary == NULL 
+        && vol->header->blosc_compressor == BLOSC_COMPRESSOR_ZSTD )
+    {   // Train on the volume itself, then write with a copy of the header
+        mrcHeader trained;
+        mrcVolume withDictionary = *vol;
+        uint8_t *dictionary = NULL;
+
+        memcpy( &trained, vol->header, sizeof(trained) );
+        trained.dictionarySize = _trainVolumeDictionary( vol->header, (const uint8_t*)mrcVolume_data( vol ), &dictionary );
+        trained.dictionary = dictionary;
+        if( dictionary == NULL )
+            trained.mrczFlags &= ~MRCZ_FLAG_DICTIONARY;
+        withDictionary.header = &trained;
+        ret = writeMRCZ( fh, &withDictionary );
+        free( dictionary );
+        return ret;
+    }
+
+    // Header
+    if( _writeHeader( fh, vol->header ) != 0 )
+    {
+        printf( "Error: writeMRCZ could not write the header\n" );
+        return -1;
+    }
+
+    // Data
+    if( vol->header->blosc_compressor > 0 )
+    {   // Compressed data
+        return _compressMRCZ( fh, vol ) == 0 && fflush( fh ) == 0 ? 0 : -1;
+    }
+    else
+    {   // Uncompressed data
+        dataPtr = mrcVolume_data(vol);
+        dsize = vol->header->dimensions[0]*vol->header->dimensions[1];
+        //printf( "dsize = %lu\n", dsize );
+        //printf( "itemsize = %lu\n", mrcVolume_itemsize(vol) );
+        if( vol->header->histogram != NULL )
+            _histogramStart( vol->header->histogram, vol->header );
+        for( int32_t k = 0; k < vol->header->dimensions[2]; k++ )
+        {   // Slice by slice, for the histogram
+            uint8_t *slice = (uint8_t*)dataPtr + k * dsize * mrcVolume_itemsize(vol);
+            if( vol->header->histogram != NULL )
+                _histogramSlice( vol->header->histogram->keys, vol->header->mrcType, slice, dsize );
+            if( fwrite( slice, mrcVolume_itemsize(vol), dsize, fh ) != dsize )
+            {
+                printf( "Error: writeMRCZ could not write slice %d\n", k );
+                return -1;
+            }
+        }
+        if( vol->header->histogram != NULL )
+            _histogramFinish( vol->header->histogram );
+    }
+    return fflush( fh ) == 0 ? 0 : -1;
+}
+
+// Number of slice buffers in flight between the reading and writing threads 
+// of transcodeMRCZ.
+#define MRCZ_PIPELINE_DEPTH         4
+
+typedef struct _transcodePipeline
+{
+    mrczReader *reader;
+    uint8_t *slots[MRCZ_PIPELINE_DEPTH];
+    uint32_t nSlices;
+    uint32_t nRead;       // slices placed in the ring by the reading thread
+    uint32_t nWritten;    // slices taken out of the ring by the writing thread
+    int error;
+#if defined(MRCZ_HAVE_PTHREADS)
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+} _transcodePipeline;
+
+#if defined(MRCZ_HAVE_PTHREADS)
+static void* _transcodeReadWorker( void *arg )
+{
+    _transcodePipeline *pipe = (_transcodePipeline*)arg;
+    for( uint32_t k = 0; k < pipe->nSlices; k++ )
+    {
+        int ret;
+        pthread_mutex_lock( &pipe->lock );
+        while( k - pipe->nWritten >= MRCZ_PIPELINE_DEPTH && !pipe->error )
+            pthread_cond_wait( &pipe->changed, &pipe->lock );
+        pthread_mutex_unlock( &pipe->lock );
+        if( pipe->error )
+            break;
+
+        ret = mrczReader_readSlice( pipe->reader, pipe->slots[k % MRCZ_PIPELINE_DEPTH] );
+
+        pthread_mutex_lock( &pipe->lock );
+        if( ret != 0 )
+            pipe->error = 1;
+        else
+            pipe->nRead++;
+        pthread_cond_broadcast( &pipe->changed );
+        pthread_mutex_unlock( &pipe->lock );
+        if( ret != 0 )
+            break;
+    }
+    return NULL;
+}
+#endif
+
+int transcodeMRCZ( FILE *fhIn, mrcHeader *inHeader, FILE *fhOut, mrcHeader *outHeader )
+{   // Convert a file slice-by-slice, e.g. to change compressor or filter, 
+    // without ever holding more than a few slices in memory.  inHeader must be 
+    // parsed and fhIn must point to the start of its data.  outHeader is 
+    // written to fhOut, and must have the same type and dimensions, except 
+    // that float32 may be quantized (MRCZ_FLAG_QUANTIZED with quantScale set). 
+    // One thread reads and decompresses while the calling thread compresses 
+    // and writes.  Returns 0 on success, or -1.
+    _transcodePipeline pipe;
+    mrczWriter *writer;
+    int ret = 0;
+    int quantize = inHeader->mrcType == MRC_FLOAT32 && outHeader->mrcType != MRC_FLOAT32 
+                   && (outHeader->mrczFlags & MRCZ_FLAG_QUANTIZED);
+
+    if( (inHeader->mrcType != outHeader->mrcType && !quantize) || inHeader->dimensions[0] != outHeader->dimensions[0]
+        || inHeader->dimensions[1] != outHeader->dimensions[1] || inHeader->dimensions[2] != outHeader->dimensions[2] )
+    {
+        printf( "Error: transcodeMRCZ requires the same type and dimensions for input and output\n" );
+        return -1;
+    }
+    if( _writeHeader( fhOut, outHeader ) != 0 )
+        return -1;
+
+    memset( &pipe, 0, sizeof(pipe) );
+    pipe.reader = mrczReader_new( fhIn, inHeader );
+    pipe.nSlices = inHeader->dimensions[2];
+    writer = mrczWriter_new( fhOut, outHeader );
+    for( int i = 0; i < MRCZ_PIPELINE_DEPTH; i++ )
+        pipe.slots[i] = malloc( pipe.reader->sliceBytes );
+
+#if defined(MRCZ_HAVE_PTHREADS)
+    {
+        pthread_t readThread;
+        pthread_mutex_init( &pipe.lock, NULL );
+        pthread_cond_init( &pipe.changed, NULL );
+        pthread_create( &readThread, NULL, _transcodeReadWorker, &pipe );
+
+        for( uint32_t k = 0; k < pipe.nSlices; k++ )
+        {
+            pthread_mutex_lock( &pipe.lock );
+            while( pipe.nRead <= k && !pipe.error )
+                pthread_cond_wait( &pipe.changed, &pipe.lock );
+            pthread_mutex_unlock( &pipe.lock );
+            if( pipe.nRead <= k )
+                break;
+
+            if( quantize )
+                ret = mrczWriter_writeFloatSlice( writer, (const float*)pipe.slots[k % MRCZ_PIPELINE_DEPTH] );
+            else
+                ret = mrczWriter_writeSlice( writer, pipe.slots[k % MRCZ_PIPELINE_DEPTH] );
+
+            pthread_mutex_lock( &pipe.lock );
+            if( ret != 0 )
+                pipe.error = 1;
+            pipe.nWritten++;
+            pthread_cond_broadcast( &pipe.changed );
+            pthread_mutex_unlock( &pipe.lock );
+            if( ret != 0 )
+                break;
+        }
+        pthread_join( readThread, NULL );
+        pthread_cond_destroy( &pipe.changed );
+        pthread_mutex_destroy( &pipe.lock );
+    }
+#else
+    for( uint32_t k = 0; k < pipe.nSlices && !pipe.error; k++ )
+    {
+        if( mrczReader_readSlice( pipe.reader, pipe.slots[0] ) != 0 
+            || (quantize ? mrczWriter_writeFloatSlice( writer, (const float*)pipe.slots[0] )
+                         : mrczWriter_writeSlice( writer, pipe.slots[0] )) != 0 )
+            pipe.error = 1;
+    }
+#endif
+
+    if( pipe.error )
+        ret = -1;
+    if( mrczWriter_free( writer ) != 0 )
+        ret = -1;
+    mrczReader_free( pipe.reader );
+    for( int i = 0; i < MRCZ_PIPELINE_DEPTH; i++ )
+        free( pipe.slots[i] );
+    return ret;
+}
+
+int verifyMRCZ( FILE *fh, mrcHeader *header, char *name_for_metadata )
+{   // Walk the chunks of an MRCZ file and check them against the CRC32C chunk 
+    // index without decompressing anything.  Returns the number of corrupt 
+    // chunks (0 if intact) or -1 if the file structure itself is damaged.  For 
+    // files written without MRCZ_FLAG_CHECKSUM only the chunk structure is 
+    // checked, the caller can tell from header->mrczFlags.
+    size_t sliceBytes;
+    uint32_t nbytes, dz;
+    uint8_t *bloscRepr = NULL;
+    size_t bloscCapacity = 0;
+    uint32_t *crcs = NULL;
+    int cbytes, nBad = 0;
+
+    if( readMRCZHeader( fh, header, name_for_metadata ) != 0 || !_validHeader( header ) )
+        return -1;
+    if( header->blosc_compressor == BLOSC_COMPRESSOR_NONE )
+        return 0;
+
+    sliceBytes = (size_t)header->dimensions[0] * header->dimensions[1] * mrcHeader_itemsize( header );
+    dz = header->dimensions[2];
+    if( header->mrczFlags & MRCZ_FLAG_CHECKSUM )
+        crcs = malloc( dz * sizeof(uint32_t) );
+    fseek( fh, MRC_HEADER_LEN + header->extendedHeaderSize, SEEK_SET );
+
+    for( uint32_t k = 0; k < dz; k++ )
+    {
+        cbytes = _readChunk( fh, &bloscRepr, &bloscCapacity );
+        if( cbytes >= 0 )
+            memcpy( &nbytes, &bloscRepr[4], sizeof(nbytes) );
+        if( cbytes < 0 || nbytes > sliceBytes 
+            || (nbytes < sliceBytes && !(header->mrczFlags & MRCZ_FLAG_SPARSE)) )
+        {
+            printf( "Error: %s slice %u has a corrupt or truncated chunk\n", name_for_metadata, k );
+            nBad = -1;
+            break;
+        }
+        if( crcs != NULL )
+            crcs[k] = _crc32c( 0, bloscRepr, cbytes );
+    }
+    if( nBad == 0 && crcs != NULL )
+        nBad = _checkChunkIndex( fh, crcs, dz, name_for_metadata );
+
+    free( crcs );
+    free( bloscRepr );
+    return nBad;
+}
+
+int _copyExtendedHeader( FILE *fhIn, mrcHeader *inHeader, FILE *fhOut )
+{   // Copy the extended header of fhIn after the standard header of fhOut, 
+    // which must already be written.  Leaves fhOut at the start of the data.
+    uint8_t *extended;
+    int ret = 0;
+
+    if( inHeader->extendedHeaderSize <= 0 )
+        return 0;
+    extended = malloc( inHeader->extendedHeaderSize );
+    if( fseek( fhIn, MRC_HEADER_LEN, SEEK_SET ) != 0
+        || fread( extended, sizeof(uint8_t), inHeader->extendedHeaderSize, fhIn ) != (size_t)inHeader->extendedHeaderSize
+        || fseek( fhOut, MRC_HEADER_LEN, SEEK_SET ) != 0
+        || fwrite( extended, sizeof(uint8_t), inHeader->extendedHeaderSize, fhOut ) != (size_t)inHeader->extendedHeaderSize )
+    {
+        printf( "Error: could not copy the extended header of %s\n", inHeader->metaname );
+        ret = -1;
+    }
+    free( extended );
+    return ret;
+}
+
+int _copySlices( FILE *fhIn, mrcHeader *inHeader, mrczChunkEntry *index, uint32_t first, uint32_t count, 
+                 mrczWriter *writer, int verbatim )
+{   // Append slices [first, first+count) of fhIn to writer.  With verbatim the 
+    // compressed chunks are copied as they are (after checking their 
+    // checksums), otherwise the slices are decoded and re-encoded.  index is 
+    // the chunk index of a compressed fhIn, or NULL to load it here.  Returns 
+    // 0 on success, or -1.
+    mrczChunkEntry *entries = index;
+    int64_t trailerStart;
+    int ret = 0;
+
+    if( entries == NULL && inHeader->blosc_compressor != BLOSC_COMPRESSOR_NONE
+        && _loadChunkIndex( fhIn, inHeader, &entries, &trailerStart ) != 0 )
+        return -1;
+
+    if( verbatim )
+    {
+        uint8_t *chunk = NULL;
+        size_t capacity = 0;
+        int cbytes;
+
+        fseek( fhIn, entries[first].offset, SEEK_SET );
+        for( uint32_t k = first; k < first + count && ret == 0; k++ )
+        {
+            cbytes = _readChunk( fhIn, &chunk, &capacity );
+            if( cbytes < 0 )
+            {
+                printf( "Error: could not read the chunk of slice %u of %s\n", k, inHeader->metaname );
+                ret = -1;
+            }
+            else if( (inHeader->mrczFlags & MRCZ_FLAG_CHECKSUM) && _crc32c( 0, chunk, cbytes ) != entries[k].crc32c )
+            {
+                printf( "Error: %s slice %u checksum mismatch\n", inHeader->metaname, k );
+                ret = -1;
+            }
+            else
+            {
+                ret = _mrczWriter_copyChunk( writer, chunk, cbytes );
+            }
+        }
+        free( chunk );
+    }
+    else
+    {
+        mrczReader *reader = mrczReader_new( fhIn, inHeader );
+        uint8_t *slice = malloc( reader->sliceBytes );
+        uint32_t start = first;
+
+        if( entries != NULL )
+        {   // Delta-coded slices are decoded from their keyframe
+            reader->entries = entries;
+            if( reader->prev != NULL )
+                start = first - first % (uint32_t)_keyframeInterval( inHeader );
+            _mrczReader_seek( reader, start, 0 );
+        }
+        else
+        {
+            _mrczReader_seek( reader, first, MRC_HEADER_LEN + inHeader->extendedHeaderSize 
+                                             + (int64_t)first * reader->sliceBytes );
+        }
+        for( uint32_t k = start; k < first + count && ret == 0; k++ )
+        {
+            ret = mrczReader_readSlice( reader, slice );
+            if( ret == 0 && k >= first )
+                ret = mrczWriter_writeSlice( writer, slice );
+        }
+        free( slice );
+        mrczReader_free( reader );
+    }
+    if( entries != index )
+        free( entries );
+    return ret;
+}
+
+int catMRCZ( FILE *fhOut, FILE **fhIn, char **inNames, int nIn )
+{   // Concatenate files along z.  The output takes the first input's header 
+    // and compression settings.  The compressed chunks of every input with the 
+    // same type, compressor and MRCZ filters are copied without decompressing 
+    // them, the others are re-encoded.  Prediction (MRCZ_FLAG_DELTA) is only 
+    // kept if all the inputs use it with the same keyframes, aligned across 
+    // the joins.  Quantized inputs must share their scale and offset.  
+    // Returns 0 on success, or -1.
+    mrcHeader **headers = calloc( nIn, sizeof(mrcHeader*) );
+    mrcHeader outHeader;
+    mrczWriter *writer = NULL;
+    uint8_t *dictionary = NULL;
+    uint32_t dz = 0, sparse = 0;
+    double sum = 0.0, sumsq = 0.0;
+    int keepDelta = 1, haveStats = 1, ret = 0;
+
+    for( int i = 0; i < nIn && ret == 0; i++ )
+    {
+        headers[i] = mrcHeader_new();
+        fseek( fhIn[i], 0, SEEK_SET );
+        if( readMRCZHeader( fhIn[i], headers[i], inNames[i] ) != 0 || !_validHeader( headers[i] ) )
+            ret = -1;
+        else if( headers[i]->mrcType != headers[0]->mrcType 
+                 || headers[i]->dimensions[0] != headers[0]->dimensions[0]
+                 || headers[i]->dimensions[1] != headers[0]->dimensions[1] )
+        {
+            printf( "Error: catMRCZ can only join files of the same type and x-y shape, unlike %s\n", inNames[i] );
+            ret = -1;
+        }
+        else if( (headers[i]->mrczFlags & MRCZ_FLAG_QUANTIZED) != (headers[0]->mrczFlags & MRCZ_FLAG_QUANTIZED)
+                 || headers[i]->quantScale != headers[0]->quantScale 
+                 || headers[i]->quantOffset != headers[0]->quantOffset )
+        {   // The integers would be read back with the first input's scale
+            printf( "Error: catMRCZ can only join files quantized with the same scale and offset, unlike %s\n", inNames[i] );
+            ret = -1;
+        }
+    }
+    if( ret != 0 || nIn == 0 )
+        goto cleanup;
+
+    for( int i = 0; i < nIn; i++ )
+    {
+        mrcHeader *h = headers[i];
+        double n = (double)h->dimensions[2];
+        if( !(h->mrczFlags & MRCZ_FLAG_DELTA) || _keyframeInterval( h ) != _keyframeInterval( headers[0] )
+            || h->blosc_compressor != headers[0]->blosc_compressor || _swapWidth( h ) != 0
+            || (i < nIn-1 && h->dimensions[2] % _keyframeInterval( h ) != 0) )
+            keepDelta = 0;
+        if( h->blosc_compressor == headers[0]->blosc_compressor )
+            sparse |= h->mrczFlags & MRCZ_FLAG_SPARSE;
+        if( h->mrcType == MRC_COMPLEX64 || (h->min == 0.0f && h->max == 0.0f && h->mean == 0.0f) )
+            haveStats = 0;
+        sum += n * h->mean;
+        sumsq += n * ((double)h->std * h->std + (double)h->mean * h->mean);
+        dz += h->dimensions[2];
+    }
+
+    outHeader = *headers[0];
+    outHeader.dimensions[2] = dz;
+    if( outHeader.mGrid[2] == headers[0]->dimensions[2] && headers[0]->dimensions[2] > 0 )
+    {   // Keep the voxel size along z
+        outHeader.cellLen[2] *= (float)dz / headers[0]->dimensions[2];
+        outHeader.mGrid[2] = dz;
+    }
+    if( !keepDelta )
+        outHeader.mrczFlags &= ~MRCZ_FLAG_DELTA;
+    outHeader.mrczFlags |= sparse;
+    outHeader.min = outHeader.max = outHeader.mean = outHeader.std = 0.0f;
+    if( haveStats )
+    {
+        double mean = sum / dz;
+        outHeader.mean = (float)mean;
+        outHeader.std = (float)sqrt( sumsq / dz - mean*mean > 0.0 ? sumsq / dz - mean*mean : 0.0 );
+        outHeader.min = headers[0]->min;
+        outHeader.max = headers[0]->max;
+        for( int i = 1; i < nIn; i++ )
+        {
+            outHeader.min = headers[i]->min < outHeader.min ? headers[i]->min : outHeader.min;
+            outHeader.max = headers[i]->max > outHeader.max ? headers[i]->max : outHeader.max;
+        }
+    }
+
+    if( outHeader.mrczFlags & MRCZ_FLAG_DICTIONARY )
+    {   // The first input's dictionary is written again, which is also its 
+        // extended header
+        dictionary = _loadDictionary( fhIn[0], headers[0] );
+        outHeader.dictionary = dictionary;
+        outHeader.dictionarySize = headers[0]->extendedHeaderSize;
+        if( dictionary == NULL )
+            outHeader.mrczFlags &= ~MRCZ_FLAG_DICTIONARY;
+    }
+    if( _writeHeader( fhOut, &outHeader ) != 0 
+        || (dictionary == NULL && _copyExtendedHeader( fhIn[0], headers[0], fhOut ) != 0) )
+    {
+        ret = -1;
+        goto cleanup;
+    }
+    writer = mrczWriter_new( fhOut, &outHeader );
+    for( int i = 0; i < nIn && ret == 0; i++ )
+    {
+        mrcHeader *h = headers[i];
+        uint32_t representation = MRCZ_FLAG_SPLITCOMPLEX | MRCZ_FLAG_DELTA | MRCZ_FLAG_DICTIONARY;
+        int verbatim = h->blosc_compressor != BLOSC_COMPRESSOR_NONE
+                       && h->blosc_compressor == outHeader.blosc_compressor
+                       && _swapWidth( h ) == 0
+                       && (h->mrczFlags & representation) == (outHeader.mrczFlags & representation);
+        if( verbatim && i > 0 && dictionary != NULL )
+        {   // Chunks can only be copied between files with the same dictionary
+            uint8_t *other = _loadDictionary( fhIn[i], h );
+            verbatim = other != NULL && h->extendedHeaderSize == outHeader.dictionarySize
+                       && memcmp( other, dictionary, outHeader.dictionarySize ) == 0;
+            free( other );
+        }
+#ifndef NDEBUG
+        printf( "DEBUG: catMRCZ %s %s\n", verbatim ? "copying" : "re-encoding", inNames[i] );
+#endif
+        ret = _copySlices( fhIn[i], h, NULL, 0, h->dimensions[2], writer, verbatim );
+    }
+    if( mrczWriter_free( writer ) != 0 )
+        ret = -1;
+
+cleanup:
+    for( int i = 0; i < nIn; i++ )
+        free( headers[i] );
+    free( headers );
+    free( dictionary );
+    return ret;
+}
+
+int _splitRange( FILE *fhIn, mrcHeader *header, mrczChunkEntry *entries, uint8_t *dictionary, 
+                 FILE *fhOut, uint32_t first, uint32_t count )
+{   // splitMRCZ of a parsed header, with the chunk index (NULL if 
+    // uncompressed) and the dictionary (for MRCZ_FLAG_DICTIONARY) of fhIn 
+    // already loaded, so that one file can be split into many.  Returns 0 on 
+    // success, or -1.
+    mrcHeader outHeader;
+    mrczWriter *writer;
+    int verbatim, ret;
+
+    outHeader = *header;
+    outHeader.dimensions[2] = count;
+    if( outHeader.mGrid[2] == header->dimensions[2] )
+    {
+        outHeader.cellLen[2] *= (float)count / header->dimensions[2];
+        outHeader.mGrid[2] = count;
+    }
+    outHeader.min = outHeader.max = outHeader.mean = outHeader.std = 0.0f;
+    verbatim = header->blosc_compressor != BLOSC_COMPRESSOR_NONE && _swapWidth( header ) == 0
+               && ( !(header->mrczFlags & MRCZ_FLAG_DELTA) || first % _keyframeInterval( header ) == 0 );
+    if( outHeader.mrczFlags & MRCZ_FLAG_DICTIONARY )
+    {   // Re-encoded slices need the dictionary too
+        outHeader.dictionary = dictionary;
+        outHeader.dictionarySize = header->extendedHeaderSize;
+    }
+
+    ret = _writeHeader( fhOut, &outHeader );
+    if( ret == 0 && dictionary == NULL )
+        ret = _copyExtendedHeader( fhIn, header, fhOut );
+    if( ret == 0 )
+    {
+        writer = mrczWriter_new( fhOut, &outHeader );
+        if( writer == NULL )
+            return -1;
+        ret = _copySlices( fhIn, header, entries, first, count, writer, verbatim );
+        if( mrczWriter_free( writer ) != 0 )
+            ret = -1;
+    }
+    return ret;
+}
+
+int _loadSplitInput( FILE *fhIn, char *inName, mrcHeader *header, mrczChunkEntry **entries, uint8_t **dictionary )
+{   // Parse the header of fhIn and load its chunk index and dictionary, as 
+    // needed by _splitRange.  Returns 0 on success, or -1 with nothing to free.
+    int64_t trailerStart;
+
+    *entries = NULL;
+    *dictionary = NULL;
+    fseek( fhIn, 0, SEEK_SET );
+    if( readMRCZHeader( fhIn, header, inName ) != 0 || !_validHeader( header ) )
+    {
+        printf( "Error: could not read %s\n", inName );
+        return -1;
+    }
+    if( header->blosc_compressor != BLOSC_COMPRESSOR_NONE
+        && _loadChunkIndex( fhIn, header, entries, &trailerStart ) != 0 )
+        return -1;
+    if( header->mrczFlags & MRCZ_FLAG_DICTIONARY )
+    {
+        *dictionary = _loadDictionary( fhIn, header );
+        if( *dictionary == NULL )
+        {
+            free( *entries );
+            *entries = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int splitMRCZ( FILE *fhIn, char *inName, FILE *fhOut, uint32_t first, uint32_t count )
+{   // Write slices [first, first+count) of fhIn to fhOut with the same 
+    // settings.  Chunks are copied without decompressing them, unless the 
+    // range starts between keyframes.  The statistics in the header are 
+    // cleared, as they cannot be known without decompressing.  Returns 0 on 
+    // success, or -1.
+    mrcHeader *header = mrcHeader_new();
+    mrczChunkEntry *entries;
+    uint8_t *dictionary;
+    int ret;
+
+    if( _loadSplitInput( fhIn, inName, header, &entries, &dictionary ) != 0 )
+    {
+        free( header );
+        return -1;
+    }
+    if( count == 0 || (uint64_t)first + count > (uint64_t)header->dimensions[2] )
+    {
+        printf( "Error: splitMRCZ cannot take %u slices from %u of %s\n", count, first, inName );
+        ret = -1;
+    }
+    else
+    {
+        ret = _splitRange( fhIn, header, entries, dictionary, fhOut, first, count );
+    }
+    free( entries );
+    free( dictionary );
+    free( header );
+    return ret;
+}
+
+int _resliceRole( mrcHeader *header, int axis, int map[3] )
+{   // Storage role of the physical axis (MRCZ_AXIS_X/Y/Z) according to 
+    // mapColRowSlice: 0 for columns, 1 for rows, 2 for sections, or -1.  map 
+    // is filled with the (validated) mapping.
+    int valid = 1;
+    for( int i = 0; i < 3; i++ )
+    {
+        map[i] = header->mapColRowSlice[i];
+        if( map[i] < MRCZ_AXIS_X || map[i] > MRCZ_AXIS_Z )
+            valid = 0;
+    }
+    if( !valid || map[0] == map[1] || map[1] == map[2] || map[0] == map[2] )
+    {   // Unset or bogus, so the default x, y, z
+        map[0] = MRCZ_AXIS_X; map[1] = MRCZ_AXIS_Y; map[2] = MRCZ_AXIS_Z;
+    }
+    for( int i = 0; i < 3; i++ )
+    {
+        if( map[i] == axis )
+            return i;
+    }
+    return -1;
+}
+
+typedef struct _resliceBlock
+{
+    uint8_t *block;           // nBlock decoded slices
+    uint8_t *gathered;        // [output slice][nBlock][row]
+    uint32_t nBlock;
+    size_t nx, ny, itemsize;
+    int byColumn;
+} _resliceBlock;
+
+#define _TRANSPOSE_TILED( type, src, dst, nx, ny, dstStride )                    \
+    for( size_t y0 = 0; y0 < ny; y0 += MRCZ_TRANSPOSE_TILE )                      \
+        for( size_t x0 = 0; x0 < nx; x0 += MRCZ_TRANSPOSE_TILE )                  \
+            for( size_t y = y0; y < y0 + MRCZ_TRANSPOSE_TILE && y < ny; y++ )    \
+                for( size_t x = x0; x < x0 + MRCZ_TRANSPOSE_TILE && x < nx; x++ )\
+                    ((type*)(dst))[x*(dstStride) + y] = ((const type*)(src))[y*(nx) + x];
+
+static void _resliceGatherWorker( void *arg, int64_t index )
+{   // Rows: index is the output slice (an input row), copied from every slice 
+    // of the block.  Columns: index is a slice of the block, transposed in 
+    // cache-sized tiles into the output slices.
+    _resliceBlock *r = (_resliceBlock*)arg;
+    size_t sliceBytes = r->nx * r->ny * r->itemsize;
+
+    if( !r->byColumn )
+    {
+        size_t rowBytes = r->nx * r->itemsize;
+        for( uint32_t b = 0; b < r->nBlock; b++ )
+            memcpy( &r->gathered[((size_t)index * r->nBlock + b) * rowBytes], 
+                    &r->block[b * sliceBytes + index * rowBytes], rowBytes );
+    }
+    else
+    {
+        const uint8_t *src = &r->block[index * sliceBytes];
+        uint8_t *dst = &r->gathered[index * r->ny * r->itemsize];
+        size_t dstStride = r->nBlock * r->ny;
+        switch( r->itemsize )
+        {
+            case 1: _TRANSPOSE_TILED( uint8_t, src, dst, r->nx, r->ny, dstStride ); break;
+            case 2: _TRANSPOSE_TILED( uint16_t, src, dst, r->nx, r->ny, dstStride ); break;
+            case 4: _TRANSPOSE_TILED( uint32_t, src, dst, r->nx, r->ny, dstStride ); break;
+            case 8: _TRANSPOSE_TILED( uint64_t, src, dst, r->nx, r->ny, dstStride ); break;
+        }
+    }
+}
+
+int resliceMRCZ( FILE *fhIn, mrcHeader *inHeader, FILE *fhOut, mrcHeader *outHeader, int axis, size_t memoryBytes )
+{   // Write the volume resliced along the physical axis (MRCZ_AXIS_X or _Y), 
+    // i.e. YZ or XZ planes as sections.  inHeader must be parsed and fhIn at 
+    // the start of its data.  outHeader supplies the compression settings; 
+    // its shape, mapColRowSlice and statistics are set here.  The input is 
+    // decoded once, in blocks of slices that fit in memoryBytes, and each 
+    // block is scattered into an uncompressed transposed copy (the output 
+    // itself if uncompressed, otherwise a temporary file that is compressed 
+    // at the end).  Returns 0 on success, or -1.
+    int map[3], role = _resliceRole( inHeader, axis, map ), byColumn = role == 0, ret = 0;
+    size_t nx = inHeader->dimensions[0], ny = inHeader->dimensions[1], nz = inHeader->dimensions[2];
+    size_t itemsize = mrcHeader_itemsize( inHeader ), sliceBytes = nx * ny * itemsize;
+    size_t rowBytes = (byColumn ? ny : nx) * itemsize, nOut = byColumn ? nx : ny;
+    size_t nBlock = memoryBytes / (2 * sliceBytes);
+    int64_t base = 0;
+    int32_t nStart[3];
+    FILE *transposed;
+    mrczReader *reader;
+    _resliceBlock r;
+
+    if( role == 2 )
+    {   // Already sections
+        memcpy( outHeader->dimensions, inHeader->dimensions, sizeof(outHeader->dimensions) );
+        outHeader->mrcType = inHeader->mrcType;
+        return transcodeMRCZ( fhIn, inHeader, fhOut, outHeader );
+    }
+    if( role < 0 )
+    {
+        printf( "Error: resliceMRCZ cannot reslice along axis %d\n", axis );
+        return -1;
+    }
+    if( nBlock < 1 )
+        nBlock = 1;
+    if( nBlock > nz )
+        nBlock = nz;
+
+    // Sections become rows, and the chosen axis becomes sections
+    memcpy( nStart, inHeader->nStart, sizeof(nStart) );
+    outHeader->mrcType = inHeader->mrcType;
+    outHeader->dimensions[0] = (int32_t)(byColumn ? ny : nx);
+    outHeader->dimensions[1] = (int32_t)nz;
+    outHeader->dimensions[2] = (int32_t)nOut;
+    outHeader->nStart[0] = byColumn ? nStart[1] : nStart[0];
+    outHeader->nStart[1] = nStart[2];
+    outHeader->nStart[2] = byColumn ? nStart[0] : nStart[1];
+    outHeader->mapColRowSlice[0] = byColumn ? map[1] : map[0];
+    outHeader->mapColRowSlice[1] = map[2];
+    outHeader->mapColRowSlice[2] = axis;
+    memcpy( outHeader->mGrid, inHeader->mGrid, sizeof(outHeader->mGrid) );
+    memcpy( outHeader->cellLen, inHeader->cellLen, sizeof(outHeader->cellLen) );
+    memcpy( outHeader->cellAngle, inHeader->cellAngle, sizeof(outHeader->cellAngle) );
+    outHeader->min = inHeader->min;
+    outHeader->max = inHeader->max;
+    outHeader->mean = inHeader->mean;
+    outHeader->std = inHeader->std;
+    outHeader->extendedHeaderSize = 0;
+    if( _writeHeader( fhOut, outHeader ) != 0 )
+        return -1;
+
+    if( outHeader->blosc_compressor == BLOSC_COMPRESSOR_NONE )
+    {
+        transposed = fhOut;
+        base = MRC_HEADER_LEN;
+    }
+    else
+    {
+        transposed = tmpfile();
+        if( transposed == NULL )
+        {
+            printf( "Error: resliceMRCZ could not create a temporary file\n" );
+            return -1;
+        }
+    }
+
+    memset( &r, 0, sizeof(r) );
+    r.nx = nx;
+    r.ny = ny;
+    r.itemsize = itemsize;
+    r.byColumn = byColumn;
+    r.block = malloc( nBlock * sliceBytes );
+    r.gathered = malloc( nBlock * sliceBytes );
+    reader = mrczReader_new( fhIn, inHeader );
+    for( size_t z0 = 0; z0 < nz && ret == 0; z0 += nBlock )
+    {
+        r.nBlock = (uint32_t)(z0 + nBlock <= nz ? nBlock : nz - z0);
+        for( uint32_t b = 0; b < r.nBlock && ret == 0; b++ )
+            ret = mrczReader_readSlice( reader, &r.block[b * sliceBytes] );
+        if( ret != 0 )
+            break;
+        _parallelFor( byColumn ? r.nBlock : (int64_t)ny, inHeader->blosc_threads, _resliceGatherWorker, &r );
+
+        // Each output slice gets a contiguous run of nBlock rows
+        for( size_t j = 0; j < nOut && ret == 0; j++ )
+        {
+            if( fseek( transposed, base + (int64_t)((j * nz + z0) * rowBytes), SEEK_SET ) != 0
+                || fwrite( &r.gathered[j * r.nBlock * rowBytes], rowBytes, r.nBlock, transposed ) != r.nBlock )
+            {
+                printf( "Error: resliceMRCZ could not write the transposed data\n" );
+                ret = -1;
+            }
+        }
+    }
+    mrczReader_free( reader );
+    free( r.gathered );
+
+    if( transposed != fhOut )
+    {   // Compress the transposed volume slice by slice
+        mrczWriter *writer;
+        uint8_t *slice = r.block;
+        size_t outSliceBytes = nz * rowBytes;
+        if( outSliceBytes > nBlock * sliceBytes )
+            slice = realloc( r.block, outSliceBytes );
+        r.block = slice;
+
+        fseek( transposed, 0, SEEK_SET );
+        writer = mrczWriter_new( fhOut, outHeader );
+        for( size_t j = 0; j < nOut && ret == 0; j++ )
+        {
+            if( fread( slice, sizeof(uint8_t), outSliceBytes, transposed ) != outSliceBytes )
+            {
+                printf( "Error: resliceMRCZ could not read back the transposed data\n" );
+                ret = -1;
+            }
+            else
+            {
+                ret = mrczWriter_writeSlice( writer, slice );
+            }
+        }
+        if( mrczWriter_free( writer ) != 0 )
+            ret = -1;
+        fclose( transposed );
+    }
+    free( r.block );
+    return ret;
+}
+
+int reslicePlaneMRCZ( FILE *fhIn, mrcHeader *header, int axis, uint32_t index, void *dest )
+{   // Extract one plane at index along the physical axis in a single pass 
+    // through the chunks: for a row or column axis dest receives nz rows (of 
+    // nx or ny items), for the section axis it receives that slice.  header 
+    // must be parsed and fhIn at the start of the data.  Returns 0 or -1.
+    int map[3], role = _resliceRole( header, axis, map ), ret = 0;
+    size_t nx = header->dimensions[0], ny = header->dimensions[1], nz = header->dimensions[2];
+    size_t itemsize = mrcHeader_itemsize( header );
+    uint8_t *out = (uint8_t*)dest, *slice;
+    mrczReader *reader;
+
+    if( role < 0 || index >= (uint32_t)header->dimensions[role] )
+    {
+        printf( "Error: reslicePlaneMRCZ has no plane %u along axis %d\n", index, axis );
+        return -1;
+    }
+    reader = mrczReader_new( fhIn, header );
+    slice = malloc( reader->sliceBytes );
+    for( size_t z = 0; z < nz && ret == 0; z++ )
+    {
+        if( role == 2 && z > index )
+            break;
+        ret = mrczReader_readSlice( reader, role == 2 ? dest : slice );
+        if( ret != 0 || role == 2 )
+            continue;
+        if( role == 1 )
+        {
+            memcpy( &out[z * nx * itemsize], &slice[index * nx * itemsize], nx * itemsize );
+        }
+        else
+        {
+            for( size_t y = 0; y < ny; y++ )
+                memcpy( &out[(z * ny + y) * itemsize], &slice[(y * nx + index) * itemsize], itemsize );
+        }
+    }
+    free( slice );
+    mrczReader_free( reader );
+    return ret;
+}
+
+int _readSliceRange( FILE *fh, mrcHeader *header, uint32_t first, uint32_t count, uint8_t *dest )
+{   // Decode slices first to first + count - 1 of a file with a parsed header 
+    // into dest, seeking with the chunk index (from the last keyframe for 
+    // delta-coded files).  Returns 0 on success, or -1.
+    mrczChunkEntry *entries = NULL;
+    mrczReader *reader;
+    uint8_t *discard = NULL;
+    uint32_t keyframe = first, dz = header->dimensions[2];
+    int64_t trailerStart;
+    int ret = 0;
+
+    if( count == 0 || first + count > dz )
+    {
+        printf( "Error: %s has no slices %u to %u\n", header->metaname, first, first + count - 1 );
+        return -1;
+    }
+    reader = mrczReader_new( fh, header );
+    if( header->blosc_compressor != BLOSC_COMPRESSOR_NONE )
+    {
+        if( _loadChunkIndex( fh, header, &entries, &trailerStart ) != 0 )
+        {
+            mrczReader_free( reader );
+            return -1;
+        }
+    }
+    else
+    {
+        entries = calloc( dz, sizeof(mrczChunkEntry) );
+        for( uint32_t k = 0; k < dz; k++ )
+            entries[k].offset = MRC_HEADER_LEN + header->extendedHeaderSize + (uint64_t)k * reader->sliceBytes;
+    }
+    reader->entries = entries;
+    if( reader->prev != NULL )
+    {
+        keyframe = first - first % (uint32_t)_keyframeInterval( header );
+        discard = malloc( reader->sliceBytes );
+    }
+    _mrczReader_seek( reader, keyframe, 0 );
+    while( ret == 0 && reader->next < first )
+        ret = mrczReader_readSlice( reader, discard );
+    for( uint32_t k = 0; k < count && ret == 0; k++ )
+        ret = mrczReader_readSlice( reader, &dest[k * reader->sliceBytes] );
+
+    free( discard );
+    mrczReader_free( reader );
+    free( entries );
+    return ret;
+}
+
+int readMRCZ_shm( FILE *fh, char *name_for_metadata, const char *shmName, uint32_t first, uint32_t count )
+{   // Decompress slices first to first + count - 1 (count 0 for all of them) 
+    // of the file at the start of fh into a new POSIX shared-memory segment 
+    // shmName (e.g. "/tomo_17"), which other processes can map with 
+    // mrcVolume_attach() without copying.  The segment outlives the process 
+    // until mrczShm_unlink().  Returns 0 on success, or -1.
+#if defined(MRCZ_HAVE_SHM)
+    mrcHeader header, shmHeader;
+    mrczShmDescriptor *desc;
+    size_t sliceBytes, totalBytes;
+    uint8_t *base;
+    int fd, ret;
+
+    memset( &header, 0, sizeof(header) );
+    header.blosc_threads = BLOSC_DEFAULT_THREADS;
+    if( readMRCZHeader( fh, &header, name_for_metadata ) != 0 || !_validHeader( &header ) )
+        return -1;
+    if( count == 0 && first < (uint32_t)header.dimensions[2] )
+        count = header.dimensions[2] - first;
+    sliceBytes = (size_t)header.dimensions[0] * header.dimensions[1] * mrcHeader_itemsize( &header );
+    totalBytes = MRCZ_SHM_DATA_OFFSET + sliceBytes * count;
+
+    fd = shm_open( shmName, O_CREAT | O_EXCL | O_RDWR, 0644 );
+    if( fd < 0 )
+    {
+        printf( "Error: could not create shared memory %s: %s\n", shmName, strerror( errno ) );
+        return -1;
+    }
+    if( ftruncate( fd, totalBytes ) != 0 
+        || (base = mmap( NULL, totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )) == MAP_FAILED )
+    {
+        printf( "Error: could not map %lu bytes of shared memory %s\n", (unsigned long)totalBytes, shmName );
+        close( fd );
+        shm_unlink( shmName );
+        return -1;
+    }
+    close( fd );
+
+    ret = _readSliceRange( fh, &header, first, count, &base[MRCZ_SHM_DATA_OFFSET] );
+    if( ret == 0 )
+    {   // The descriptor describes the data as it is in memory
+        desc = (mrczShmDescriptor*)base;
+        memcpy( &shmHeader, &header, sizeof(shmHeader) );
+        shmHeader.dimensions[2] = count;
+        shmHeader.blosc_compressor = BLOSC_COMPRESSOR_NONE;
+        shmHeader.mrczFlags &= MRCZ_FLAG_QUANTIZED;   // with quantScale and quantOffset
+        shmHeader.extendedHeaderSize = 0;
+        _buildStandardHeader( &shmHeader, desc->header );
+        desc->totalBytes = totalBytes;
+        desc->first = first;
+        memcpy( desc->magic, MRCZ_SHM_MAGIC, sizeof(desc->magic) );
+        __sync_synchronize();
+        desc->ready = 1;
+    }
+    munmap( base, totalBytes );
+    if( ret != 0 )
+        shm_unlink( shmName );
+    return ret;
+#else
+    (void)fh; (void)name_for_metadata; (void)first; (void)count;
+    printf( "Error: shared memory %s is not supported on this platform\n", shmName );
+    return -1;
+#endif
+}
+
+#if defined(MRCZ_HAVE_SHM)
+static void _shmDetach( void *ptr, void *opaque )
+{   // mrcVolume_free() hook of attached volumes: unmap the whole segment
+    uint8_t *base = (uint8_t*)ptr - MRCZ_SHM_DATA_OFFSET;
+    (void)opaque;
+    munmap( base, ((mrczShmDescriptor*)base)->totalBytes );
+}
+#endif
+
+mrcVolume* mrcVolume_attach( const char *shmName )
+{   // Map a segment made by readMRCZ_shm() read-only, as a volume whose data 
+    // points straight into the shared memory.  mrcVolume_free() unmaps it.  
+    // Returns NULL if the segment does not exist or is not complete.
+#if defined(MRCZ_HAVE_SHM)
+    struct stat st;
+    mrczShmDescriptor *desc;
+    mrcHeader *header;
+    mrcVolume *self;
+    uint8_t *base, headerBytes[MRC_HEADER_LEN];
+    int fd = shm_open( shmName, O_RDONLY, 0 );
+
+    if( fd < 0 )
+    {
+        printf( "Error: could not open shared memory %s: %s\n", shmName, strerror( errno ) );
+        return NULL;
+    }
+    if( fstat( fd, &st ) != 0 || st.st_size < MRCZ_SHM_DATA_OFFSET
+        || (base = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 )) == MAP_FAILED )
+    {
+        printf( "Error: could not map shared memory %s\n", shmName );
+        close( fd );
+        return NULL;
+    }
+    close( fd );
+    desc = (mrczShmDescriptor*)base;
+    if( memcmp( desc->magic, MRCZ_SHM_MAGIC, sizeof(desc->magic) ) != 0 || !desc->ready 
+        || desc->totalBytes != (uint64_t)st.st_size )
+    {
+        printf( "Error: shared memory %s does not hold a complete volume\n", shmName );
+        munmap( base, st.st_size );
+        return NULL;
+    }
+
+    header = mrcHeader_new();
+    memcpy( headerBytes, desc->header, MRC_HEADER_LEN );
+    if( _parseStandardHeader( headerBytes, header, (char*)shmName ) != 0 
+        || (uint64_t)header->dimensions[0] * header->dimensions[1] * header->dimensions[2] 
+           * mrcHeader_itemsize( header ) + MRCZ_SHM_DATA_OFFSET > desc->totalBytes )
+    {
+        printf( "Error: shared memory %s has a corrupt header\n", shmName );
+        free( header );
+        munmap( base, st.st_size );
+        return NULL;
+    }
+    self = mrcVolume_new( header, &base[MRCZ_SHM_DATA_OFFSET] );
+    self->allocator.free = _shmDetach;
+    return self;
+#else
+    printf( "Error: shared memory %s is not supported on this platform\n", shmName );
+    return NULL;
+#endif
+}
+
+int mrczShm_unlink( const char *shmName )
+{   // Remove a segment made by readMRCZ_shm().  Volumes still attached stay 
+    // valid until they are freed.  Returns 0 on success, or -1.
+#if defined(MRCZ_HAVE_SHM)
+    return shm_unlink( shmName ) == 0 ? 0 : -1;
+#else
+    (void)shmName;
+    return -1;
+#endif
+}
+
+int appendMRCZ( FILE *fh, mrcVolume *vol )
+{   // Append the z-slices of vol to the end of an existing MRC/MRCZ file, which 
+    // must be opened for update ("r+b").  The new slices are compressed with 
+    // the compressor, filter and blocksize already used in the file (the 
+    // compression level and threads come from vol->header) and the header is 
+    // patched in-place, so the cost is proportional to the new data only.
+    // Returns the number of slices appended, or -1 on error.
+    uint8_t headerBytes[MRC_HEADER_LEN];
+    mrcHeader existing;
+    mrczChunkEntry *entries = NULL;
+    mrczWriter *writer;
+    uint8_t *prev = NULL, *dictionary = NULL;
+    int64_t trailerStart;
+    uint32_t dzOld, dzNew = vol->header->dimensions[2];
+    size_t sliceSize, itemsize;
+    int ret = 0;
+
+    memset( &existing, 0, sizeof(existing) );
+    fseek( fh, 0, SEEK_SET );
+    if( fread( headerBytes, sizeof(uint8_t), MRC_HEADER_LEN, fh ) != MRC_HEADER_LEN )
+    {
+        printf( "Error: appendMRCZ could not read the existing header\n" );
+        return -1;
+    }
+    _parseStandardHeader( headerBytes, &existing, vol->header->metaname );
+    if( !_validHeader( &existing ) 
+        || existing.mrcType != vol->header->mrcType
+        || existing.dimensions[0] != vol->header->dimensions[0] 
+        || existing.dimensions[1] != vol->header->dimensions[1] )
+    {
+        printf( "Error: appendMRCZ can only append slices of the same type and x-y shape\n" );
+        return -1;
+    }
+    if( _swapWidth( &existing ) != 0 )
+    {
+        printf( "Error: appendMRCZ cannot append to a file in the other byte order\n" );
+        return -1;
+    }
+    dzOld = existing.dimensions[2];
+    itemsize = mrcHeader_itemsize( &existing );
+    sliceSize = (size_t)existing.dimensions[0] * existing.dimensions[1];
+
+    if( existing.blosc_compressor == BLOSC_COMPRESSOR_NONE )
+    {
+        fseek( fh, MRC_HEADER_LEN + existing.extendedHeaderSize + itemsize*sliceSize*dzOld, SEEK_SET );
+        if( fwrite( mrcVolume_data(vol), itemsize, sliceSize*dzNew, fh ) != sliceSize*dzNew )
+            return -1;
+    }
+    else
+    {
+        uint8_t bloscHeader[BLOSC_MIN_HEADER_LENGTH];
+        uint32_t blocksize;
+
+        if( _loadChunkIndex( fh, &existing, &entries, &trailerStart ) != 0 )
+            return -1;
+        // Re-use the filter and blocksize of the first chunk, blosc doesn't 
+        // record the compression level.
+        fseek( fh, entries[0].offset, SEEK_SET );
+        if( fread( bloscHeader, sizeof(uint8_t), BLOSC_MIN_HEADER_LENGTH, fh ) != BLOSC_MIN_HEADER_LENGTH )
+        {
+            free( entries );
+            return -1;
+        }
+        if( bloscHeader[2] & BLOSC_DOBITSHUFFLE )
+            existing.blosc_filter = BLOSC_BITSHUFFLE;
+        else if( bloscHeader[2] & BLOSC_DOSHUFFLE )
+            existing.blosc_filter = BLOSC_SHUFFLE;
+        else
+            existing.blosc_filter = BLOSC_NOSHUFFLE;
+        memcpy( &blocksize, &bloscHeader[8], sizeof(blocksize) );
+        existing.blosc_blocksize = blocksize;
+        existing.blosc_clevel = vol->header->blosc_clevel;
+        existing.blosc_threads = vol->header->blosc_threads > 0 ? vol->header->blosc_threads : BLOSC_DEFAULT_THREADS;
+
+        if( existing.mrczFlags & MRCZ_FLAG_DELTA )
+        {   // The predictor needs the last slice, decoded from its keyframe
+            uint32_t keyframe = ((dzOld - 1) / _keyframeInterval( &existing )) * _keyframeInterval( &existing );
+            mrczReader *reader = mrczReader_new( fh, &existing );
+            uint8_t *slice = malloc( reader->sliceBytes );
+            _mrczReader_seek( reader, keyframe, entries[keyframe].offset );
+            while( ret == 0 && reader->next < dzOld )
+                ret = mrczReader_readSlice( reader, slice );
+            if( ret == 0 )
+            {
+                prev = malloc( reader->sliceBytes );
+                memcpy( prev, reader->prev, reader->sliceBytes );
+            }
+            free( slice );
+            mrczReader_free( reader );
+            if( ret != 0 )
+            {
+                free( entries );
+                return -1;
+            }
+        }
+
+        // New chunks overwrite the old trailer, and the writer carries on 
+        // from the old chunk index.
+        if( existing.mrczFlags & MRCZ_FLAG_DICTIONARY )
+        {
+            dictionary = _loadDictionary( fh, &existing );
+            existing.dictionary = dictionary;
+            existing.dictionarySize = existing.extendedHeaderSize;
+        }
+        fseek( fh, trailerStart, SEEK_SET );
+        existing.dimensions[2] = dzOld + dzNew;
+        writer = mrczWriter_new( fh, &existing );
+        if( writer->entries != NULL )
+            memcpy( writer->entries, entries, dzOld * sizeof(mrczChunkEntry) );
+        if( prev != NULL )
+        {
+            memcpy( writer->prev, prev, writer->sliceBytes );
+            free( prev );
+        }
+        writer->next = dzOld;
+        free( entries );
+        for( uint32_t k = 0; k < dzNew && ret == 0; k++ )
+            ret = mrczWriter_writeSlice( writer, &((uint8_t*)mrcVolume_data(vol))[k*writer->sliceBytes] );
+        if( mrczWriter_free( writer ) != 0 )
+            ret = -1;
+        free( dictionary );
+        if( ret != 0 )
+            return -1;
+        // An old pyramid no longer covers the volume and is dropped, which 
+        // may leave the file shorter than it was.
+        _truncateFile( fh );
+    }
+
+    {   // Patch the header: z-dimension, sampling along z if it tracked the 
+        // number of slices, and the running statistics.
+        double min = existing.min, max = existing.max, sum = 0.0, sumsq = 0.0;
+        double nOld = (double)sliceSize * dzOld, nNew = (double)sliceSize * dzNew;
+        int32_t dz = dzOld + dzNew;
+
+        memcpy( &headerBytes[8], &dz, sizeof(dz) );
+        if( existing.mGrid[2] == (int32_t)dzOld )
+        {
+            float cellLen = existing.mGrid[2] > 0 ? existing.cellLen[2] * dz / existing.mGrid[2] : existing.cellLen[2];
+            memcpy( &headerBytes[36], &dz, sizeof(dz) );
+            memcpy( &headerBytes[48], &cellLen, sizeof(cellLen) );
+        }
+        if( existing.mrcType != MRC_COMPLEX64 && !(existing.min == 0.0f && existing.max == 0.0f && existing.mean == 0.0f) )
+        {   // Only merge statistics that were set in the first place
+            float fmin, fmax, fmean, fstd;
+            double mean, var;
+            _accumulateStats( mrcVolume_data(vol), existing.mrcType, (size_t)nNew, &min, &max, &sum, &sumsq );
+            mean = (existing.mean * nOld + sum) / (nOld + nNew);
+            var = ( nOld * (existing.std*existing.std + existing.mean*existing.mean) + sumsq ) / (nOld + nNew) - mean*mean;
+            fmin = (float)min; fmax = (float)max; fmean = (float)mean; fstd = (float)sqrt( var > 0.0 ? var : 0.0 );
+            memcpy( &headerBytes[76], &fmin, sizeof(fmin) );
+            memcpy( &headerBytes[80], &fmax, sizeof(fmax) );
+            memcpy( &headerBytes[84], &fmean, sizeof(fmean) );
+            memcpy( &headerBytes[216], &fstd, sizeof(fstd) );
+        }
+        fseek( fh, 0, SEEK_SET );
+        if( fwrite( headerBytes, sizeof(uint8_t), MRC_HEADER_LEN, fh ) != MRC_HEADER_LEN )
+            return -1;
+    }
+    return dzNew;
+}
+
+static void _appendFilename( char ***names, int *nNames, int *capacity, const char *name )
+{
+    if( *nNames >= *capacity )
+    {
+        *capacity = (*capacity > 0) ? 2 * (*capacity) : 256;
+        *names = realloc( *names, (*capacity) * sizeof(char*) );
+    }
+    (*names)[(*nNames)++] = strdup( name );
+}
+
+int _listFiles( const char *path, char ***names, int *nNames, int *capacity )
+{   // Recursively collect the regular files under path (or path itself if it 
+    // is a file).  Returns the number of files added.
+    struct stat st;
+    int nAdded = 0;
+
+    if( stat( path, &st ) != 0 )
+    {
+        printf( "Warning: could not stat %s\n", path );
+        return 0;
+    }
+    if( S_ISREG( st.st_mode ) )
+    {
+        _appendFilename( names, nNames, capacity, path );
+        return 1;
+    }
+#if defined(MRCZ_HAVE_PTHREADS)
+    if( S_ISDIR( st.st_mode ) )
+    {
+        DIR *dir = opendir( path );
+        struct dirent *entry;
+        char *child;
+        if( dir == NULL )
+            return 0;
+        while( (entry = readdir( dir )) != NULL )
+        {
+            if( strcmp( entry->d_name, "." ) == 0 || strcmp( entry->d_name, ".." ) == 0 )
+                continue;
+            child = malloc( strlen(path) + strlen(entry->d_name) + 2 );
+            sprintf( child, "%s/%s", path, entry->d_name );
+            nAdded += _listFiles( child, names, nNames, capacity );
+            free( child );
+        }
+        closedir( dir );
+    }
+#else
+    if( S_ISDIR( st.st_mode ) )
+        printf( "Warning: directory scanning is not supported on this platform, pass files instead: %s\n", path );
+#endif
+    return nAdded;
+}
+
+#if !defined(MRCZ_LIBRARY)
+// Command-line utility, left out of the library builds
+
+static int _compareStrings( const void *a, const void *b )
+{
+    return strcmp( *(char* const*)a, *(char* const*)b );
+}
+
+int _scanMain( int argc, char *argv[] )
+{   // mrcz scan [-n <# threads>] <dir|file> ...
+    int opt, n_threads = 4 * getNumCPU(), nNames = 0, capacity = 0, nValid;
+    char **names = NULL;
+    mrczFileInfo *infos;
+    int64_t totalRaw = 0, totalData = 0;
+
+    optind = 1;
+    while( (opt = getopt( argc, argv, "n:h" )) != -1 )
+    {
+        switch( opt )
+        {
+            case 'n':
+                n_threads = atoi( optarg );
+                break;
+            case 'h':
+                _print_help();
+                return 0;
+        }
+    }
+    for( int i = optind; i < argc; i++ )
+        _listFiles( argv[i], &names, &nNames, &capacity );
+    if( nNames == 0 )
+    {
+        printf( "Error: no files found to scan.\n" );
+        return -1;
+    }
+    qsort( names, nNames, sizeof(char*), _compareStrings );
+
+    infos = calloc( nNames, sizeof(mrczFileInfo) );
+    for( int i = 0; i < nNames; i++ )
+        infos[i].filename = names[i];
+    nValid = scanMRCZ( infos, nNames, n_threads );
+
+    printf( "%-48s %6s %6s %6s %4s %-8s %14s %9s\n", 
+            "file", "nx", "ny", "nz", "mode", "comp", "bytes", "ratio(%)" );
+    for( int i = 0; i < nNames; i++ )
+    {
+        mrczFileInfo *info = &infos[i];
+        if( info->status != 0 )
+            continue;
+        printf( "%-48s %6d %6d %6d %4d %-8s %14" PRId64 " %9.1f\n", info->filename,
+                info->header.dimensions[0], info->header.dimensions[1], info->header.dimensions[2],
+                info->header.mrcType, _compressorName( info->header.blosc_compressor ),
+                info->dataBytes, info->dataBytes > 0 ? 100.0 * info->rawBytes / info->dataBytes : 0.0 );
+        totalRaw += info->rawBytes;
+        totalData += info->dataBytes;
+    }
+    printf( "Scanned %d files, %d MRC/MRCZ, %" PRId64 " bytes on disk, ratio %.1f %%\n", 
+            nNames, nValid, totalData, totalData > 0 ? 100.0 * totalRaw / totalData : 0.0 );
+
+    for( int i = 0; i < nNames; i++ )
+        free( names[i] );
+    free( names );
+    free( infos );
+    return 0;
+}
+
+static void _verifyWorker( void *arg, int64_t index )
+{
+    mrczFileInfo *info = &((mrczFileInfo*)arg)[index];
+    FILE *fh = fopen( info->filename, "rb" );
+    if( fh == NULL )
+    {
+        info->status = -1;
+        return;
+    }
+    info->status = verifyMRCZ( fh, &info->header, info->filename );
+    fclose( fh );
+}
+
+int _verifyMain( int argc, char *argv[] )
+{   // mrcz verify [-n <# threads>] <dir|file> ...
+    int opt, n_threads = getNumCPU(), nNames = 0, capacity = 0, nFailed = 0;
+    char **names = NULL;
+    mrczFileInfo *infos;
+
+    optind = 1;
+    while( (opt = getopt( argc, argv, "n:h" )) != -1 )
+    {
+        switch( opt )
+        {
+            case 'n':
+                n_threads = atoi( optarg );
+                break;
+            case 'h':
+                _print_help();
+                return 0;
+        }
+    }
+    for( int i = optind; i < argc; i++ )
+        _listFiles( argv[i], &names, &nNames, &capacity );
+    if( nNames == 0 )
+    {
+        printf( "Error: no files found to verify.\n" );
+        return -1;
+    }
+    qsort( names, nNames, sizeof(char*), _compareStrings );
+
+    infos = calloc( nNames, sizeof(mrczFileInfo) );
+    for( int i = 0; i < nNames; i++ )
+        infos[i].filename = names[i];
+    _parallelFor( nNames, n_threads, _verifyWorker, (void*)infos );
+
+    for( int i = 0; i < nNames; i++ )
+    {
+        mrczFileInfo *info = &infos[i];
+        if( info->status < 0 )
+            printf( "%-48s FAILED (unreadable)\n", info->filename );
+        else if( info->status > 0 )
+            printf( "%-48s FAILED (%d corrupt chunks)\n", info->filename, info->status );
+        else if( info->header.blosc_compressor != BLOSC_COMPRESSOR_NONE 
+                 && (info->header.mrczFlags & MRCZ_FLAG_CHECKSUM) )
+            printf( "%-48s OK\n", info->filename );
+        else
+            printf( "%-48s OK (no checksums)\n", info->filename );
+        if( info->status != 0 )
+            nFailed++;
+        free( names[i] );
+    }
+    printf( "Verified %d files, %d failed\n", nNames, nFailed );
+    free( names );
+    free( infos );
+    return nFailed > 0 ? 1 : 0;
+}
+
+void _print_help()
+{
+    // IF NO COMMAND ARGS, or -h
+    printf( "Usage:  mrcz -i <input_file> -o <output_file> [-c <compressor> -B <blocksize>\n-l <compression_level> -f <filter_enum> -n <# threads> -s -x -p <interval> -e <fill> -r <levels>\n-t <bits> -E <error> -R <error>\n-q <int8|int16|uint16> -S <scale>,<offset> -I -D <KB> -a ]\n" );
+    printf( "  Takes an input MRC/Z file and transforms it into a compressed/\n  decompressed MRC/Z file.\n" );
+    printf( "Options:\n" );
+    printf( "    **All arguments apply to the output file only**.\n" );
+    printf( "    -c is one of 'none', 'lz4', 'lz4hc', 'zlib', or 'zstd' (default).\n" );
+    printf( "    -B is the size of each compression block in bytes (default: 131072).\n" );
+    printf( "    -l  is compression level, 0 is uncompressed, 9 is very slow (default: 1). \n        Compression ratio with 'zstd' saturates at about 4.\n" );
+    printf( "    -f  is the filter, 0 is no filter, 1 is byte-shuffle, 2 is bit-shuffle (default).\n"  );
+    printf( "    -n is the number of threads (default: to the number of cores).\n" );
+    printf( "    -s stores a CRC32C checksum of every compressed slice.\n" );
+    printf( "    -x stores complex64 slices as separate real and imaginary planes.\n" );
+    printf( "    -p stores each slice as the difference to the previous one, with a whole\n       keyframe every <interval> slices (1 turns prediction off).\n" );
+    printf( "    -e stores slices with less than <fill> (e.g. 0.05) non-zero pixels as lists of\n       events, 0 turns this off.\n" );
+    printf( "    -r also stores <levels> overviews, each binned 2x2x2 from the one before.\n" );
+    printf( "    -t rounds float data to <bits> of mantissa (1-22, lossy), -R to within a\n       relative <error>, and -E to within an absolute <error>.\n" );
+    printf( "    -q stores float32 data as int8, int16 or uint16, scaled to the range of the\n       data or as (value - offset) / scale with -S.\n" );
+    printf( "    -I stores float32 data that is all whole numbers as int8, int16 or uint16,\n       losslessly.\n" );
+    printf( "    -D trains a zstd dictionary of <KB> kilobytes (e.g. 110) from sample slices and\n       compresses every slice with it (zstd only, needs USE_ZSTD_DICT).\n" );
+    printf( "    -a appends the slices of the input file to the existing output file, re-using\n       its compressor and filter.\n" );
+    printf( "    -i - and -o - read from stdin and write to stdout, for pipelines.  Messages then\n       go to stderr.  -a, -I, -D and -q without -S need a file to read twice.\n" );
+    printf( "\nUsage:  mrcz scan [-n <# threads>] <dir|file> ...\n" );
+    printf( "  Reads only the headers of every file under the given directories and \n  prints a table of dimensions, mode, compressor, size and ratio.\n" );
+    printf( "\nUsage:  mrcz verify [-n <# threads>] <dir|file> ...\n" );
+    printf( "  Checks the slice checksums of MRCZ files without decompressing them.\n" );
+    printf( "\nUsage:  mrcz cat <output_file> <input_file> ...\n" );
+    printf( "  Stacks files along z, copying compressed slices without recompressing them\n  when the compressor and filters match the first input.\n" );
+    printf( "\nUsage:  mrcz split [-z <slices per file>] <input_file> <output_prefix>\n" );
+    printf( "  Cuts a file into <output_prefix>_NNNN.mrcz files, copying compressed slices.\n" );
+    printf( "\nUsage:  mrcz reslice [-a <x|y|z>] [-P <index>] [-m <MB>] [-c <compressor>] <input_file> <output_file>\n" );
+    printf( "  Writes the YZ (-a x), XZ (-a y, default) or XY (-a z) planes as the slices of\n  the output, with x, y and z as given by the axis mapping of the header,\n" );
+    printf( "  streaming through the input once with at most -m MB of slices (default: 256).\n" );
+    printf( "  -P writes only the plane at <index>.\n" );
+    printf( "\nUsage:  mrcz shm [-f <first slice>] [-z <# slices>] <input_file> <name>\n" );
+    printf( "  Decompresses into the POSIX shared memory <name> for mrcVolume_attach(),\n  until removed with: mrcz shm -u <name>\n" );
+    printf( "\nUsage:  mrcz watch [-c <compressor> -l <level> -f <filter> -B <blocksize> -n <# threads>\n-w <# workers> -d -1] <input_dir> <output_dir>\n" );
+    printf( "  Compresses every .mrc/.mrcs file that is closed in or moved into <input_dir>\n" );
+    printf( "  into <output_dir>, with checksums, on -w files at a time (default: 2).  Each is\n" );
+    printf( "  written to a hidden file, verified and renamed into place.  -d removes the\n" );
+    printf( "  input once the output decompresses to the same data.  -1 only converts the\n  files already there and exits.  Outputs that exist are left alone, and an input\n" );
+    printf( "  newer than its output, or a.mrc next to a.mrcs, is reported as failed.\n" );
+}
+
+/*
+  Command-line
+*/
+int _catMain( int argc, char *argv[] )
+{   // mrcz cat <output> <input> ...
+    FILE *fhOut, **fhIn;
+    int nIn = argc - 2, ret = 0;
+
+    if( nIn < 1 )
+    {
+        _print_help();
+        return -1;
+    }
+    fhIn = calloc( nIn, sizeof(FILE*) );
+    for( int i = 0; i < nIn; i++ )
+    {
+        fhIn[i] = fopen( argv[i+2], "rb" );
+        if( fhIn[i] == NULL )
+        {
+            printf( "Error: could not open %s\n", argv[i+2] );
+            ret = -1;
+        }
+    }
+    if( ret == 0 )
+    {
+        fhOut = fopen( argv[1], "wb" );
+        if( fhOut == NULL )
+        {
+            printf( "Error: could not open %s\n", argv[1] );
+            ret = -1;
+        }
+        else
+        {
+            ret = catMRCZ( fhOut, fhIn, &argv[2], nIn );
+            fclose( fhOut );
+        }
+    }
+    for( int i = 0; i < nIn; i++ )
+    {
+        if( fhIn[i] != NULL )
+            fclose( fhIn[i] );
+    }
+    free( fhIn );
+    return ret;
+}
+
+int _splitMain( int argc, char *argv[] )
+{   // mrcz split -z <slices per file> <input> <output prefix>
+    int opt, perFile = 1, ret = 0;
+    uint32_t dz;
+    char *outName;
+    FILE *fhIn, *fhOut;
+    mrcHeader *header;
+    mrczChunkEntry *entries;
+    uint8_t *dictionary;
+
+    optind = 1;
+    while( (opt = getopt( argc, argv, "z:h" )) != -1 )
+    {
+        switch( opt )
+        {
+            case 'z':
+                perFile = atoi( optarg );
+                break;
+            case 'h':
+                _print_help();
+                return 0;
+        }
+    }
+    if( argc - optind != 2 || perFile < 1 )
+    {
+        _print_help();
+        return -1;
+    }
+    fhIn = fopen( argv[optind], "rb" );
+    if( fhIn == NULL )
+    {
+        printf( "Error: could not open %s\n", argv[optind] );
+        return -1;
+    }
+    header = mrcHeader_new();
+    if( _loadSplitInput( fhIn, argv[optind], header, &entries, &dictionary ) != 0 )
+    {   // The index and dictionary are loaded once for all of the outputs
+        fclose( fhIn );
+        free( header );
+        return -1;
+    }
+    dz = header->dimensions[2];
+    outName = malloc( strlen(argv[optind+1]) + 16 );
+    for( uint32_t first = 0; first < dz && ret == 0; first += perFile )
+    {
+        uint32_t count = first + perFile <= dz ? (uint32_t)perFile : dz - first;
+        sprintf( outName, "%s_%04u.mrcz", argv[optind+1], first / perFile );
+        fhOut = fopen( outName, "wb" );
+        if( fhOut == NULL )
+        {
+            printf( "Error: could not open %s\n", outName );
+            ret = -1;
+            break;
+        }
+        ret = _splitRange( fhIn, header, entries, dictionary, fhOut, first, count );
+        fclose( fhOut );
+        printf( "%s: slices %u to %u\n", outName, first, first + count - 1 );
+    }
+    fclose( fhIn );
+    free( outName );
+    free( entries );
+    free( dictionary );
+    free( header );
+    return ret;
+}
+
+int _resliceMain( int argc, char *argv[] )
+{   // mrcz reslice -a <x|y|z> [-P <index>] [-m <MB>] [-c <compressor>] [-n <# threads>] <input> <output>
+    int opt, axis = MRCZ_AXIS_Y, plane = -1, ret;
+    size_t memoryBytes = MRCZ_DEFAULT_RESLICE_MEMORY;
+    char *compressor = NULL;
+    FILE *fhIn, *fhOut;
+    mrcHeader *header = mrcHeader_new(), *outHeader = mrcHeader_new();
+
+    optind = 1;
+    while( (opt = getopt( argc, argv, "a:P:m:c:n:h" )) != -1 )
+    {
+        switch( opt )
+        {
+            case 'a':
+                axis = strcmp( optarg, "x" ) == 0 ? MRCZ_AXIS_X : (strcmp( optarg, "y" ) == 0 ? MRCZ_AXIS_Y 
+                       : (strcmp( optarg, "z" ) == 0 ? MRCZ_AXIS_Z : -1));
+                break;
+            case 'P':
+                plane = atoi( optarg );
+                break;
+            case 'm':
+                memoryBytes = (size_t)atol( optarg ) * 1024 * 1024;
+                break;
+            case 'c':
+                compressor = optarg;
+                break;
+            case 'n':
+                header->blosc_threads = outHeader->blosc_threads = atoi( optarg );
+                break;
+            case 'h':
+                _print_help();
+                free( header );
+                free( outHeader );
+                return 0;
+        }
+    }
+    if( argc - optind != 2 || axis < 0 )
+    {
+        if( axis < 0 )
+            printf( "Error: -a takes the axis x, y or z\n" );
+        else
+            _print_help();
+        free( header );
+        free( outHeader );
+        return -1;
+    }
+    fhIn = fopen( argv[optind], "rb" );
+    if( fhIn == NULL || readMRCZHeader( fhIn, header, argv[optind] ) != 0 )
+    {
+        printf( "Error: could not read %s\n", argv[optind] );
+        if( fhIn != NULL )
+            fclose( fhIn );
+        free( header );
+        free( outHeader );
+        return -1;
+    }
+    fseek( fhIn, MRC_HEADER_LEN + header->extendedHeaderSize, SEEK_SET );
+    fhOut = fopen( argv[optind+1], "wb" );
+    if( fhOut == NULL )
+    {
+        printf( "Error: could not open %s\n", argv[optind+1] );
+        fclose( fhIn );
+        free( header );
+        free( outHeader );
+        return -1;
+    }
+
+    // Same compression as the input unless asked otherwise
+    outHeader->blosc_compressor = header->blosc_compressor;
+    outHeader->mrczFlags = header->mrczFlags;
+    outHeader->keyframeInterval = header->keyframeInterval;
+    outHeader->quantScale = header->quantScale;
+    outHeader->quantOffset = header->quantOffset;
+    outHeader->quantizedType = header->quantizedType;
+    if( compressor != NULL && _compressorCode( compressor ) >= 0 )
+        outHeader->blosc_compressor = _compressorCode( compressor );
+
+    if( plane >= 0 )
+    {   // A single plane, as a one-slice file
+        int map[3], role = _resliceRole( header, axis, map );
+        mrcVolume *vol;
+        size_t nBytes = (size_t)header->dimensions[0] * header->dimensions[1] * mrcHeader_itemsize( header );
+        if( role == 0 || role == 1 )
+            nBytes = (size_t)header->dimensions[2] * header->dimensions[1-role] * mrcHeader_itemsize( header );
+        outHeader->mrcType = header->mrcType;
+        outHeader->dimensions[0] = role == 0 ? header->dimensions[1] : header->dimensions[0];
+        outHeader->dimensions[1] = role == 2 ? header->dimensions[1] : header->dimensions[2];
+        outHeader->dimensions[2] = 1;
+        vol = mrcVolume_new( outHeader, malloc( nBytes ) );
+        ret = reslicePlaneMRCZ( fhIn, header, axis, (uint32_t)plane, mrcVolume_data( vol ) );
+        if( ret == 0 && writeMRCZ( fhOut, vol ) != 0 )
+        {
+            printf( "Error: could not write %s\n", argv[optind+1] );
+            ret = -1;
+        }
+        mrcVolume_free( vol );
+    }
+    else
+    {
+        ret = resliceMRCZ( fhIn, header, fhOut, outHeader, axis, memoryBytes );
+        free( outHeader );
+    }
+    fclose( fhIn );
+    if( fclose( fhOut ) != 0 && ret == 0 )
+    {
+        printf( "Error: could not write %s\n", argv[optind+1] );
+        ret = -1;
+    }
+    free( header );
+    return ret;
+}
 
-/*
-  MRCZ library public functions
-*/ 
-//Consider overloaded readMRCZ( char *filename, mrcVolume *dest ) that opens the file.
+int _shmMain( int argc, char *argv[] )
+{   // mrcz shm [-f <first>] [-z <count>] <input> <name>, or mrcz shm -u <name>
+    int opt, removeSegment = 0, ret;
+    uint32_t first = 0, count = 0;
+    FILE *fh;
 
-int readMRCZ( FILE *fh, mrcVolume *dest, char *name_for_metadata )
-{   // Read from a file handle and then write to an address mrcVolume struct, dest.
-    // filename is optional and will be saved into the associated dest->header->filename.
-    uint8_t headerBytes[MRC_HEADER_LEN];
-    int fh_dataStartPos = MRC_HEADER_LEN;
-    int fread_ret;
-    mrcHeader *header;
-    
-    header = mrcHeader_new();
-    dest->header = header;
+    optind = 1;
+    while( (opt = getopt( argc, argv, "f:z:uh" )) != -1 )
+    {
+        switch( opt )
+        {
+            case 'f':
+                first = (uint32_t)atol( optarg );
+                break;
+            case 'z':
+                count = (uint32_t)atol( optarg );
+                break;
+            case 'u':
+                removeSegment = 1;
+                break;
+            case 'h':
+                _print_help();
+                return 0;
+        }
+    }
+    if( removeSegment && argc - optind == 1 )
+        return mrczShm_unlink( argv[optind] );
+    if( argc - optind != 2 )
+    {
+        _print_help();
+        return -1;
+    }
+    fh = fopen( argv[optind], "rb" );
+    if( fh == NULL )
+    {
+        printf( "Error: could not open %s\n", argv[optind] );
+        return -1;
+    }
+    ret = readMRCZ_shm( fh, argv[optind], argv[optind+1], first, count );
+    fclose( fh );
+    if( ret == 0 )
+        printf( "%s: decompressed into shared memory %s\n", argv[optind], argv[optind+1] );
+    return ret;
+}
+
+#if defined(MRCZ_HAVE_INOTIFY)
+#define MRCZ_WATCH_SUFFIX       ".part"
+
+typedef struct _watchQueue
+{
+    char **names;         // ring of input file names waiting for a worker
+    int capacity;
+    int head;
+    int count;
+    int closed;
+    char *inDir;
+    char *outDir;
+    mrcHeader *options;   // compression settings for the output files
+    int removeInput;
+    int nDone;
+    int nFailed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} _watchQueue;
+
+static volatile sig_atomic_t _watchStop = 0;
+
+static void _watchSignal( int sig )
+{
+    (void)sig;
+    _watchStop = 1;
+}
+
+static int _watchCandidate( const char *name )
+{   // Uncompressed MRC files, but not hidden (i.e. temporary) ones
+    const char *dot = strrchr( name, '.' );
+    return name[0] != '.' && dot != NULL && (strcmp( dot, ".mrc" ) == 0 || strcmp( dot, ".mrcs" ) == 0);
+}
 
-    if( ! (fread_ret = fread( (void *)headerBytes, sizeof(uint8_t), MRC_HEADER_LEN, fh ) ) )
+static void _watchPush( _watchQueue *queue, const char *name )
+{   // Blocks while all workers are busy and the queue is full, so that a burst 
+    // of new files waits in the inotify buffer of the kernel rather than here.
+    pthread_mutex_lock( &queue->lock );
+    while( queue->count == queue->capacity && !queue->closed )
+        pthread_cond_wait( &queue->changed, &queue->lock );
+    if( !queue->closed )
     {
-        printf( "Error: failed to read 1024-bytes from header of %s, error code: %d\n", name_for_metadata, fread_ret );
-        return fread_ret;
+        queue->names[(queue->head + queue->count) % queue->capacity] = strdup( name );
+        queue->count++;
+        pthread_cond_broadcast( &queue->changed );
     }
+    pthread_mutex_unlock( &queue->lock );
+}
 
-    _parseStandardHeader( headerBytes, header, name_for_metadata );
+static char* _watchPop( _watchQueue *queue )
+{   // The next file name, to be freed by the caller, or NULL once the queue is 
+    // closed and empty
+    char *name = NULL;
+    pthread_mutex_lock( &queue->lock );
+    while( queue->count == 0 && !queue->closed )
+        pthread_cond_wait( &queue->changed, &queue->lock );
+    if( queue->count > 0 )
+    {
+        name = queue->names[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_broadcast( &queue->changed );
+    }
+    pthread_mutex_unlock( &queue->lock );
+    return name;
+}
 
-    // Check for presence of extended header
-    fh_dataStartPos += header->extendedHeaderSize;
-#ifndef NDEBUG
-    printf( "DEBUG: seeking to %i in order to read data.\n", fh_dataStartPos );
-#endif
-    // TODO: read extended header information if desired
-    fseek( fh, fh_dataStartPos, SEEK_SET );
+static void _watchClose( _watchQueue *queue, int discard )
+{   // Let the workers finish, after the waiting files unless discard is set
+    pthread_mutex_lock( &queue->lock );
+    queue->closed = 1;
+    for( ; discard && queue->count > 0; queue->count-- )
+    {
+        free( queue->names[queue->head] );
+        queue->head = (queue->head + 1) % queue->capacity;
+    }
+    pthread_cond_broadcast( &queue->changed );
+    pthread_mutex_unlock( &queue->lock );
+}
 
-    // Branch into compressed or uncompressed implementations
-    if( header->blosc_compressor > 0 )
-    {   // Compressed data
-        _decompressMRCZ( fh, dest );
+static void _watchScan( _watchQueue *queue )
+{   // Queue the files already in the directory, in name order
+    char **names = NULL;
+    int nNames = 0, capacity = 0;
+    struct dirent *entry;
+    DIR *dir = opendir( queue->inDir );
+    if( dir == NULL )
+        return;
+    while( (entry = readdir( dir )) != NULL )
+    {
+        if( _watchCandidate( entry->d_name ) )
+            _appendFilename( &names, &nNames, &capacity, entry->d_name );
     }
-    else
-    {   // Uncompressed data
-        fread_ret = _loadUncompressedMRC( fh, dest );
+    closedir( dir );
+    qsort( names, nNames, sizeof(char*), _compareStrings );
+    for( int i = 0; i < nNames; i++ )
+    {
+        _watchPush( queue, names[i] );
+        free( names[i] );
     }
-    return fread_ret;
+    free( names );
 }
 
-int writeMRCZ( FILE *fh, mrcVolume *vol )
-{
-    // Header
-    int fh_dataStartPos = MRC_HEADER_LEN;
-    uint8_t *headerBytes;
-    void *dataPtr;
-    size_t dsize;
-    int fwrite_ret = 0;
-    
-    headerBytes = _buildStandardHeader( fh, vol->header );
-    fh_dataStartPos += vol->header->extendedHeaderSize;
+static int _watchCompare( const char *inPath, const char *outPath )
+{   // Decompress the output and compare it to the input, slice by slice.  
+    // Returns 0 if they match.
+    FILE *fh[2];
+    mrcHeader *headers[2];
+    mrczReader *readers[2] = { NULL, NULL };
+    uint8_t *slices[2] = { NULL, NULL };
+    int ret = -1;
 
-    // TODO: handle writing extended header
-    fwrite( headerBytes, sizeof(uint8_t), MRC_HEADER_LEN, fh );
+    fh[0] = fopen( inPath, "rb" );
+    fh[1] = fopen( outPath, "rb" );
+    for( int i = 0; i < 2; i++ )
+    {
+        headers[i] = mrcHeader_new();
+        if( fh[i] == NULL || readMRCZHeader( fh[i], headers[i], (char*)(i == 0 ? inPath : outPath) ) != 0 
+            || _skipExtendedHeader( fh[i], headers[i], NULL ) != 0 )
+            goto done;
+    }
+    if( headers[0]->mrcType != headers[1]->mrcType || headers[0]->dimensions[0] != headers[1]->dimensions[0]
+        || headers[0]->dimensions[1] != headers[1]->dimensions[1] || headers[0]->dimensions[2] != headers[1]->dimensions[2] )
+        goto done;
+    for( int i = 0; i < 2; i++ )
+    {
+        readers[i] = mrczReader_new( fh[i], headers[i] );
+        slices[i] = malloc( readers[i]->sliceBytes );
+    }
+    ret = 0;
+    for( int32_t k = 0; k < headers[0]->dimensions[2] && ret == 0; k++ )
+    {
+        if( mrczReader_readSlice( readers[0], slices[0] ) != 0 || mrczReader_readSlice( readers[1], slices[1] ) != 0
+            || memcmp( slices[0], slices[1], readers[0]->sliceBytes ) != 0 )
+            ret = -1;
+    }
 
-    // Data
-#ifndef NDEBUG
-    printf( "DEBUG: seeking to %i in order to write data.\n", fh_dataStartPos );
-#endif
-    // TODO: read extended header information if desired
-    fseek( fh, fh_dataStartPos, SEEK_SET );
-    if( vol->header->blosc_compressor > 0 )
-    {   // Compressed data
+done:
+    for( int i = 0; i < 2; i++ )
+    {
+        if( readers[i] != NULL )
+            mrczReader_free( readers[i] );
+        if( fh[i] != NULL )
+            fclose( fh[i] );
+        free( slices[i] );
+        free( headers[i] );
+    }
+    return ret;
+}
+
+static int _watchConvert( _watchQueue *queue, const char *name )
+{   // Compress inDir/name to outDir/<name>z through a hidden temporary file in 
+    // outDir, which is checked and then renamed into place, so that the output 
+    // either exists complete or not at all.  Returns 0 when converted, 1 when 
+    // skipped (already done, in progress or still being written), or -1, also 
+    // when a.mrc and a.mrcs would both become a.mrcz or the input changed 
+    // after its output was written.
+    size_t length = strlen( queue->inDir ) + strlen( queue->outDir ) + strlen( name ) + 16;
+    char *inPath = malloc( length ), *outPath = malloc( length ), *tmpPath = malloc( length );
+    char *otherPath = malloc( length );
+    mrcHeader *header = mrcHeader_new(), *outHeader = mrcHeader_new(), *check = mrcHeader_new();
+    FILE *fhIn = NULL, *fhOut = NULL;
+    struct stat st, inSt;
+    int stem = (int)(strrchr( name, '.' ) - name), fd, created = 0, ret = -1;
 
-        _compressMRCZ( fh, vol );
+    sprintf( inPath, "%s/%s", queue->inDir, name );
+    sprintf( outPath, "%s/%.*s.mrcz", queue->outDir, stem, name );
+    sprintf( tmpPath, "%s/.%s" MRCZ_WATCH_SUFFIX, queue->outDir, strrchr( outPath, '/' ) + 1 );
+    sprintf( otherPath, "%s/%.*s%s", queue->inDir, stem, name, strcmp( name + stem, ".mrc" ) == 0 ? ".mrcs" : ".mrc" );
+    if( stat( otherPath, &st ) == 0 )
+    {
+        printf( "Error: %s and %s would both be compressed to %s, leaving them\n", inPath, otherPath, outPath );
+        goto done;
     }
-    else
-    {   // Uncompressed data
-        dataPtr = mrcVolume_data(vol);
-        dsize = vol->header->dimensions[0]*vol->header->dimensions[1]*vol->header->dimensions[2];
-        //printf( "dsize = %lu\n", dsize );
-        //printf( "itemsize = %lu\n", mrcVolume_itemsize(vol) );
-        fwrite_ret = fwrite( dataPtr, mrcVolume_itemsize(vol), dsize, fh );
+    if( stat( outPath, &st ) == 0 )
+    {   // Done before, unless the input is newer than the output
+        if( stat( inPath, &inSt ) == 0 && inSt.st_mtime > st.st_mtime )
+            printf( "Error: %s changed after %s was written, or that came from another input; not overwriting it\n", 
+                    inPath, outPath );
+        else
+            ret = 1;
+        goto done;
+    }
+    fhIn = fopen( inPath, "rb" );
+    if( fhIn == NULL )
+    {
+        printf( "Error: could not open %s\n", inPath );
+        goto done;
     }
-    return fwrite_ret;
+    if( readMRCZHeader( fhIn, header, inPath ) != 0 || !_validHeader( header ) )
+        goto done;
+    if( header->blosc_compressor == BLOSC_COMPRESSOR_NONE && fstat( fileno( fhIn ), &st ) == 0 
+        && st.st_size < MRC_HEADER_LEN + header->extendedHeaderSize + (int64_t)header->dimensions[0] 
+                        * header->dimensions[1] * header->dimensions[2] * (int64_t)mrcHeader_itemsize( header ) )
+    {   // Found by the initial scan while still being written, it comes back 
+        // with the event for its close
+        printf( "%s: incomplete, waiting for it to be closed\n", inPath );
+        ret = 1;
+        goto done;
+    }
+    if( _skipExtendedHeader( fhIn, header, NULL ) != 0 )
+        goto done;
+
+    // O_EXCL also keeps a second event for the same file from converting it twice
+    fd = open( tmpPath, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+    if( fd < 0 )
+    {
+        ret = errno == EEXIST ? 1 : -1;
+        if( ret < 0 )
+            printf( "Error: could not create %s\n", tmpPath );
+        goto done;
+    }
+    created = 1;
+    fhOut = fdopen( fd, "wb" );
+    if( fhOut == NULL )
+    {
+        close( fd );
+        goto done;
+    }
+
+    memcpy( outHeader, header, sizeof(*outHeader) );
+    outHeader->blosc_compressor = queue->options->blosc_compressor;
+    outHeader->blosc_clevel = queue->options->blosc_clevel;
+    outHeader->blosc_filter = queue->options->blosc_filter;
+    outHeader->blosc_blocksize = queue->options->blosc_blocksize;
+    outHeader->blosc_threads = queue->options->blosc_threads;
+    outHeader->mrczFlags = (outHeader->mrczFlags & ~MRCZ_FLAG_DICTIONARY) | MRCZ_FLAG_CHECKSUM;
+    if( header->mrczFlags & MRCZ_FLAG_DICTIONARY )
+        outHeader->extendedHeaderSize = 0;
+    if( transcodeMRCZ( fhIn, header, fhOut, outHeader ) != 0 
+        || (!(header->mrczFlags & MRCZ_FLAG_DICTIONARY) && _copyExtendedHeader( fhIn, header, fhOut ) != 0)
+        || fflush( fhOut ) != 0 || fsync( fileno( fhOut ) ) != 0 )
+    {
+        printf( "Error: failed to compress %s\n", inPath );
+        goto done;
+    }
+    fclose( fhOut );
+    fhOut = NULL;
+
+    // Check the chunk checksums, and before throwing away the input, the data
+    fhOut = fopen( tmpPath, "rb" );
+    if( fhOut == NULL || verifyMRCZ( fhOut, check, tmpPath ) != 0 
+        || (queue->removeInput && _watchCompare( inPath, tmpPath ) != 0) )
+    {
+        printf( "Error: %s did not verify, keeping %s\n", tmpPath, inPath );
+        goto done;
+    }
+    if( rename( tmpPath, outPath ) != 0 )
+    {
+        printf( "Error: could not rename %s to %s\n", tmpPath, outPath );
+        goto done;
+    }
+    created = 0;
+    fd = open( queue->outDir, O_RDONLY );
+    if( fd >= 0 )
+    {   // Make the rename itself durable before the input goes
+        fsync( fd );
+        close( fd );
+    }
+    if( queue->removeInput && unlink( inPath ) != 0 )
+        printf( "Warning: could not remove %s\n", inPath );
+    printf( "%s -> %s\n", inPath, outPath );
+    ret = 0;
+
+done:
+    if( fhOut != NULL )
+        fclose( fhOut );
+    if( fhIn != NULL )
+        fclose( fhIn );
+    if( created )
+        remove( tmpPath );
+    free( inPath );
+    free( outPath );
+    free( tmpPath );
+    free( otherPath );
+    free( header );
+    free( outHeader );
+    free( check );
+    return ret;
 }
 
-void _print_help()
+static void* _watchWorker( void *arg )
 {
-    // IF NO COMMAND ARGS, or -h
-    printf( "Usage:  mrcz -i <input_file> -o <output_file> [-c <compressor> -B <blocksize>\n-l <compression_level> -f <filter_enum> -n <# threads> ]\n" );
-    printf( "  Takes an input MRC/Z file and transforms it into a compressed/\n  decompressed MRC/Z file.\n" );
-    printf( "Options:\n" );
-    printf( "    **All arguments apply to the output file only**.\n" );
-    printf( "    -c is one of 'none', 'lz4', 'lz4hc', 'zlib', or 'zstd' (default).\n" );
-    printf( "    -B is the size of each compression block in bytes (default: 131072).\n" );
-    printf( "    -l  is compression level, 0 is uncompressed, 9 is very slow (default: 1). \n        Compression ratio with 'zstd' saturates at about 4.\n" );
-    printf( "    -f  is the filter, 0 is no filter, 1 is byte-shuffle, 2 is bit-shuffle (default).\n"  );
-    printf( "    -n is the number of threads (default: to the number of cores).\n" );
+    _watchQueue *queue = (_watchQueue*)arg;
+    char *name;
+    while( (name = _watchPop( queue )) != NULL )
+    {
+        int ret = _watchConvert( queue, name );
+        pthread_mutex_lock( &queue->lock );
+        if( ret == 0 )
+            queue->nDone++;
+        else if( ret < 0 )
+            queue->nFailed++;
+        pthread_mutex_unlock( &queue->lock );
+        free( name );
+    }
+    return NULL;
+}
+#endif
+
+int _watchMain( int argc, char *argv[] )
+{   // mrcz watch [-c <compressor>] [-l <level>] [-f <filter>] [-B <blocksize>] 
+    //   [-n <# threads>] [-w <# workers>] [-d] [-1] <input_dir> <output_dir>
+#if defined(MRCZ_HAVE_INOTIFY)
+    int opt, n_threads = getNumCPU(), n_workers = 2, once = 0, fd = -1;
+    mrcHeader *options = mrcHeader_new();
+    _watchQueue queue;
+    pthread_t *workers;
+    char buffer[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)] 
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct stat st;
+
+    memset( &queue, 0, sizeof(queue) );
+    optind = 1;
+    while( (opt = getopt( argc, argv, "c:l:f:B:n:w:d1h" )) != -1 )
+    {
+        switch( opt )
+        {
+            case 'c':
+                if( _compressorCode( optarg ) >= 0 )
+                    options->blosc_compressor = _compressorCode( optarg );
+                break;
+            case 'l':
+                options->blosc_clevel = atoi( optarg );
+                break;
+            case 'f':
+                options->blosc_filter = atoi( optarg );
+                break;
+            case 'B':
+                if( atoi( optarg ) > 4096 )
+                    options->blosc_blocksize = atoi( optarg );
+                break;
+            case 'n':
+                n_threads = atoi( optarg );
+                break;
+            case 'w':
+                n_workers = atoi( optarg );
+                break;
+            case 'd':
+                queue.removeInput = 1;
+                break;
+            case '1':
+                once = 1;
+                break;
+            case 'h':
+                _print_help();
+                free( options );
+                return 0;
+        }
+    }
+    if( argc - optind != 2 || n_workers < 1 )
+    {
+        _print_help();
+        free( options );
+        return -1;
+    }
+    queue.inDir = argv[optind];
+    queue.outDir = argv[optind+1];
+    if( stat( queue.inDir, &st ) != 0 || !S_ISDIR( st.st_mode ) )
+    {
+        printf( "Error: %s is not a directory\n", queue.inDir );
+        free( options );
+        return -1;
+    }
+    if( stat( queue.outDir, &st ) != 0 && mkdir( queue.outDir, 0755 ) != 0 )
+    {
+        printf( "Error: could not create %s\n", queue.outDir );
+        free( options );
+        return -1;
+    }
+    if( options->blosc_compressor == BLOSC_COMPRESSOR_NONE )
+    {
+        printf( "Error: mrcz watch needs a compressor\n" );
+        free( options );
+        return -1;
+    }
+
+    if( !once )
+    {   // Watch before the initial scan so that no file falls in between.  A 
+        // file is complete when its writer closes it or it is moved in.
+        fd = inotify_init1( IN_CLOEXEC | IN_NONBLOCK );
+        if( fd < 0 || inotify_add_watch( fd, queue.inDir, IN_CLOSE_WRITE | IN_MOVED_TO ) < 0 )
+        {
+            printf( "Error: could not watch %s: %s\n", queue.inDir, strerror( errno ) );
+            if( fd >= 0 )
+                close( fd );
+            free( options );
+            return -1;
+        }
+        signal( SIGINT, _watchSignal );
+        signal( SIGTERM, _watchSignal );
+        printf( "Watching %s for new MRC files, compressing into %s (Ctrl-C to stop)\n", queue.inDir, queue.outDir );
+    }
+    // The blosc threads are shared out between the files in flight
+    options->blosc_threads = n_threads / n_workers > 0 ? n_threads / n_workers : 1;
+    queue.options = options;
+    queue.capacity = 2 * n_workers;
+    queue.names = calloc( queue.capacity, sizeof(char*) );
+    pthread_mutex_init( &queue.lock, NULL );
+    pthread_cond_init( &queue.changed, NULL );
+    workers = malloc( n_workers * sizeof(pthread_t) );
+    for( int i = 0; i < n_workers; i++ )
+        pthread_create( &workers[i], NULL, _watchWorker, &queue );
+    _watchScan( &queue );
+
+    while( !once && !_watchStop )
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        ssize_t length;
+        if( poll( &pfd, 1, 500 ) <= 0 )
+            continue;
+        while( (length = read( fd, buffer, sizeof(buffer) )) > 0 && !_watchStop )
+        {
+            for( char *ptr = buffer; ptr < buffer + length; )
+            {
+                struct inotify_event *event = (struct inotify_event*)ptr;
+                if( event->mask & IN_Q_OVERFLOW )
+                {   // Events were lost while the workers were behind
+                    _watchScan( &queue );
+                }
+                else if( event->mask & IN_IGNORED )
+                {
+                    printf( "Error: %s went away\n", queue.inDir );
+                    _watchStop = 1;
+                }
+                else if( event->len > 0 && _watchCandidate( event->name ) )
+                {
+                    _watchPush( &queue, event->name );
+                }
+                ptr += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+
+    // Files not yet started are left for the next run
+    _watchClose( &queue, _watchStop );
+    for( int i = 0; i < n_workers; i++ )
+        pthread_join( workers[i], NULL );
+    if( fd >= 0 )
+        close( fd );
+    printf( "Compressed %d files, %d failed\n", queue.nDone, queue.nFailed );
+    pthread_cond_destroy( &queue.changed );
+    pthread_mutex_destroy( &queue.lock );
+    free( workers );
+    free( queue.names );
+    free( options );
+    return queue.nFailed > 0 ? 1 : 0;
+#else
+    (void)argc;
+    (void)argv;
+    printf( "Error: mrcz watch needs inotify (Linux)\n" );
+    return -1;
+#endif
+}
+
+FILE* _stdStream( int output )
+{   // stdin or stdout for "-" on the command line, in binary mode.  stdout is 
+    // taken over for the data: it is duplicated, and everything printed to 
+    // stdout from then on goes to stderr.  Returns NULL on failure.
+    int fd;
+    FILE *fh;
+#if defined(_WIN32)
+    _setmode( _fileno( output ? stdout : stdin ), _O_BINARY );
+#endif
+    if( !output )
+        return stdin;
+    fflush( stdout );
+    fd = dup( fileno( stdout ) );
+    fh = fd >= 0 ? fdopen( fd, "wb" ) : NULL;
+    if( fh == NULL || dup2( fileno( stderr ), fileno( stdout ) ) < 0 )
+        return NULL;
+    return fh;
 }
 
-/*
-  Command-line
-*/
 int main(int argc, char *argv[])
 {
-    char *inputName, *outputName, *compressor;
-    FILE *fh;
+    char *inputName = NULL, *outputName = NULL, *compressor = NULL;
+    FILE *fh, *fhOut = NULL;
+    mrcHeader *header, *outHeader;
     mrcVolume *vol;
-    int opt, blocksize=-1, n_threads=-1, filter=-1, clevel=-1;
-    int fwrite_len = 0;
+    int opt, blocksize=-1, n_threads=-1, filter=-1, clevel=-1, checksum=0, append=0, splitComplex=0, keyframes=0, pyramid=0, mantissaBits=-1;
+    float sparse = -1.0f, absoluteError = -1.0f, quantScale = 0.0f, quantOffset = 0.0f;
+    char *quantizeTo = NULL;
+    uint8_t *dictionary = NULL, *inputDictionary = NULL;
+    int ret, detectIntegers = 0, dictionaryKB = 0, piped;
     
+    for( int i = 1; i + 1 < argc && fhOut == NULL; i++ )
+    {   // Writing to stdout, so messages (starting with this one) go to stderr
+        if( strcmp( argv[i], "-o" ) == 0 && strcmp( argv[i+1], "-" ) == 0 )
+            fhOut = _stdStream( 1 );
+    }
     printf( "Compressed MRC file-format command-line utility, ver.%d.%d.%d\n", 
            MRCZ_VERSION_MAJOR, MRCZ_VERSION_MINOR, MRCZ_VERSION_RELEASE ); 
     
@@ -603,7 +5474,22 @@ int main(int argc, char *argv[])
         _print_help();
         return 0;
     }
-    while( (opt = getopt (argc, argv, "i:o:c:B:l:f:n:h") ) != -1)
+    if( strcmp( argv[1], "scan" ) == 0 )
+        return _scanMain( argc-1, &argv[1] );
+    if( strcmp( argv[1], "verify" ) == 0 )
+        return _verifyMain( argc-1, &argv[1] );
+    if( strcmp( argv[1], "cat" ) == 0 )
+        return _catMain( argc-1, &argv[1] ) == 0 ? 0 : 1;
+    if( strcmp( argv[1], "split" ) == 0 )
+        return _splitMain( argc-1, &argv[1] ) == 0 ? 0 : 1;
+    if( strcmp( argv[1], "reslice" ) == 0 )
+        return _resliceMain( argc-1, &argv[1] ) == 0 ? 0 : 1;
+    if( strcmp( argv[1], "shm" ) == 0 )
+        return _shmMain( argc-1, &argv[1] ) == 0 ? 0 : 1;
+    if( strcmp( argv[1], "watch" ) == 0 )
+        return _watchMain( argc-1, &argv[1] ) == 0 ? 0 : 1;
+
+    while( (opt = getopt (argc, argv, "i:o:c:B:l:f:n:saxp:e:r:t:E:R:q:S:ID:h") ) != -1)
     {
         switch (opt)
         {
@@ -635,6 +5521,57 @@ int main(int argc, char *argv[])
                 n_threads = atoi( optarg );
                 //printf( "n_threads: \"%d\"\n", n_threads );
                 break;
+            case 's':
+                checksum = 1;
+                break;
+            case 'a':
+                append = 1;
+                break;
+            case 'x':
+                splitComplex = 1;
+                break;
+            case 'p':
+                keyframes = atoi( optarg );
+                break;
+            case 'e':
+                sparse = (float)atof( optarg );
+                break;
+            case 'r':
+                pyramid = atoi( optarg );
+                break;
+            case 't':
+                mantissaBits = atoi( optarg );
+                break;
+            case 'E':
+                absoluteError = (float)atof( optarg );
+                break;
+            case 'q':
+                quantizeTo = optarg;
+                break;
+            case 'I':
+                detectIntegers = 1;
+                break;
+            case 'D':
+                dictionaryKB = atoi( optarg );
+                break;
+            case 'S':
+                if( sscanf( optarg, "%f,%f", &quantScale, &quantOffset ) < 1 )
+                    quantScale = 0.0f;
+                break;
+            case 'R':
+                {   // Keeping n bits bounds the relative error to 2^-(n+1), 0 is lossless
+                    char *end;
+                    double relative = strtod( optarg, &end );
+                    if( end == optarg || *end != '\0' || relative < 0.0 || relative > 0.25 )
+                    {
+                        printf( "Error: -R takes a relative error from 0 (lossless) to 0.25, not %s\n", optarg );
+                        return -1;
+                    }
+                    mantissaBits = relative > 0.0 ? (int)ceil( -log2( relative ) ) - 1 : 0;
+                    if( mantissaBits > 22 )
+                        mantissaBits = 0;
+                }
+                break;
             case 'h':
                 _print_help();
                 return 0;
@@ -642,66 +5579,251 @@ int main(int argc, char *argv[])
     }
 
 
-    // INPUT READ/DECOMPRESS
-    fh = fopen( inputName, "rb" );
+    if( inputName == NULL || outputName == NULL )
+    {
+        _print_help();
+        return -1;
+    }
+
+    // INPUT HEADER, "-" streams from stdin and to stdout without seeking
+    // The pre-passes of -q (without -S), -I and -D re-read the input
+    piped = strcmp( inputName, "-" ) == 0;
+    if( (piped && (detectIntegers || dictionaryKB > 0 || (quantizeTo != NULL && quantScale == 0.0f)))
+        || (append && (piped || fhOut != NULL)) )
+    {
+        printf( "Error: -a, -I, -D and -q without -S need files, not pipes.\n" );
+        return -1;
+    }
+    fh = strcmp( inputName, "-" ) == 0 ? _stdStream( 0 ) : fopen( inputName, "rb" );
     if( fh == NULL )
     {
         printf( "Error: could not open %s to be read.\n", inputName );
         return -1;
     }
     
-    vol = mrcVolume_new( NULL, NULL );
-    if( ! readMRCZ( fh, vol, inputName ) )
-    {   // We have error messages in readMRC
+    header = mrcHeader_new();
+    if( readMRCZHeader( fh, header, inputName ) != 0 )
+    {   // We have error messages in readMRCZHeader
         return -1;
     }
-    fclose( fh );
-
+    if( _skipExtendedHeader( fh, header, (header->mrczFlags & MRCZ_FLAG_DICTIONARY) ? &inputDictionary : NULL ) != 0 )
+        return -1;
+    header->dictionary = inputDictionary;
+    header->dictionarySize = inputDictionary != NULL ? header->extendedHeaderSize : 0;
 
-    // Apply command-line options to header
+    // Apply command-line options to a copy of the input header
+    outHeader = mrcHeader_new();
+    memcpy( outHeader, header, sizeof(*outHeader) );
     if( n_threads >  0)
-        vol->header->blosc_threads = n_threads;
+        outHeader->blosc_threads = n_threads;
     if( blocksize >  4096)
-        vol->header->blosc_blocksize = blocksize;
+        outHeader->blosc_blocksize = blocksize;
     if( filter >= 0 )
-        vol->header->blosc_filter = filter;
+        outHeader->blosc_filter = filter;
     if( clevel >= 0 )
-        vol->header->blosc_clevel = clevel;
-    if( compressor != NULL )
-    {
-        if( strcmp(compressor, BLOSC_NONE_COMPNAME) == 0 )
-            vol->header->blosc_compressor = BLOSC_COMPRESSOR_NONE;
-        else if( strcmp(compressor, BLOSC_BLOSCLZ_COMPNAME) == 0 )
-            vol->header->blosc_compressor = BLOSC_COMRPRESSOR_BLOSCLZ;
-        else if( strcmp(compressor, BLOSC_LZ4_COMPNAME) == 0 )
-            vol->header->blosc_compressor = BLOSC_COMPRESSOR_LZ4;
-        else if( strcmp(compressor, BLOSC_LZ4HC_COMPNAME) == 0 )
-            vol->header->blosc_compressor = BLOSC_COMPRESSOR_LZ4HC;
-        else if( strcmp(compressor, BLOSC_SNAPPY_COMPNAME) == 0 )
-            vol->header->blosc_compressor = BLOSC_COMPRESSOR_SNAPPY;
-        else if( strcmp(compressor, BLOSC_ZLIB_COMPNAME) == 0 )
-            vol->header->blosc_compressor = BLOSC_COMPRESSOR_ZLIB;
-        else if( strcmp(compressor, BLOSC_ZSTD_COMPNAME) == 0 )
-            vol->header->blosc_compressor = BLOSC_COMPRESSOR_ZSTD;
+        outHeader->blosc_clevel = clevel;
+    if( checksum )
+        outHeader->mrczFlags |= MRCZ_FLAG_CHECKSUM;
+    if( splitComplex )
+        outHeader->mrczFlags |= MRCZ_FLAG_SPLITCOMPLEX;
+    if( keyframes > 1 )
+    {
+        outHeader->mrczFlags |= MRCZ_FLAG_DELTA;
+        outHeader->keyframeInterval = keyframes;
+    }
+    else if( keyframes == 1 )
+    {   // Every slice a keyframe, i.e. no prediction
+        outHeader->mrczFlags &= ~MRCZ_FLAG_DELTA;
+    }
+    if( sparse > 0.0f )
+    {
+        outHeader->mrczFlags |= MRCZ_FLAG_SPARSE;
+        outHeader->sparseThreshold = sparse;
+    }
+    else if( sparse == 0.0f )
+    {
+        outHeader->mrczFlags &= ~MRCZ_FLAG_SPARSE;
+    }
+    if( compressor != NULL && _compressorCode( compressor ) >= 0 )
+        outHeader->blosc_compressor = _compressorCode( compressor );
+    outHeader->pyramidLevels = pyramid;
+    if( mantissaBits >= 0 )
+        outHeader->mantissaBits = mantissaBits;
+    if( absoluteError >= 0.0f )
+        outHeader->absoluteError = absoluteError;
+    if( header->mrczFlags & MRCZ_FLAG_DICTIONARY )
+    {   // The extended header is the input's dictionary, which is not kept
+        outHeader->mrczFlags &= ~MRCZ_FLAG_DICTIONARY;
+        outHeader->extendedHeaderSize = 0;
+    }
+    if( quantizeTo != NULL && header->mrcType == MRC_FLOAT32 && !append )
+    {   // The range comes from a pass over the input unless -S is given
+        double min = HUGE_VAL, max = -HUGE_VAL, sum = 0.0, sumsq = 0.0;
+        mrcHeader *stored = mrcHeader_new();
+
+        outHeader->quantizedType = strcmp( quantizeTo, "int8" ) == 0 ? MRC_INT8 
+            : strcmp( quantizeTo, "uint16" ) == 0 ? MRC_UINT16 : MRC_INT16;
+        outHeader->quantScale = quantScale;
+        outHeader->quantOffset = quantOffset;
+        if( quantScale == 0.0f )
+        {
+            mrczReader *reader = mrczReader_new( fh, header );
+            uint8_t *slice = malloc( reader->sliceBytes );
+            size_t sliceItems = reader->sliceBytes / sizeof(float);
+            for( int32_t k = 0; k < header->dimensions[2]; k++ )
+            {
+                if( mrczReader_readSlice( reader, slice ) != 0 )
+                    return -1;
+                _accumulateStats( slice, MRC_FLOAT32, sliceItems, &min, &max, &sum, &sumsq );
+            }
+            free( slice );
+            mrczReader_free( reader );
+            fseek( fh, MRC_HEADER_LEN + header->extendedHeaderSize, SEEK_SET );
+        }
+        else
+        {
+            min = header->min;
+            max = header->max;
+        }
+        if( _quantizedHeader( outHeader, stored, min, max ) != 0 )
+            return -1;
+        free( outHeader );
+        outHeader = stored;
+    }
+    else if( detectIntegers && header->mrcType == MRC_FLOAT32 && !append )
+    {   // A pass over the input, stopping at the first slice that is not whole 
+        // numbers, decides on lossless quantization
+        double min = HUGE_VAL, max = -HUGE_VAL;
+        mrczReader *reader = mrczReader_new( fh, header );
+        uint8_t *slice = malloc( reader->sliceBytes );
+        size_t sliceItems = reader->sliceBytes / sizeof(float);
+        int32_t k;
+        for( k = 0; k < header->dimensions[2]; k++ )
+        {
+            if( mrczReader_readSlice( reader, slice ) != 0 )
+                return -1;
+            if( !_floatsAreIntegers( (float*)slice, sliceItems, &min, &max ) || _integerTypeFor( min, max ) < 0 )
+                break;
+        }
+        free( slice );
+        mrczReader_free( reader );
+        fseek( fh, MRC_HEADER_LEN + header->extendedHeaderSize, SEEK_SET );
+        if( k == header->dimensions[2] && k > 0 )
+        {
+            mrcHeader *stored = mrcHeader_new();
+            outHeader->quantizedType = _integerTypeFor( min, max );
+            outHeader->quantScale = 1.0f;
+            outHeader->quantOffset = 0.0f;
+            if( _quantizedHeader( outHeader, stored, min, max ) != 0 )
+                return -1;
+            printf( "%s: whole-numbered float32, stored as mrcType %d\n", inputName, stored->mrcType );
+            free( outHeader );
+            outHeader = stored;
+        }
+    }
+    if( dictionaryKB > 0 && !append && outHeader->blosc_compressor != BLOSC_COMPRESSOR_ZSTD )
+    {
+        printf( "Error: -D trains a zstd dictionary, so it needs -c zstd\n" );
+        return -1;
+    }
+    if( dictionaryKB > 0 && !append )
+    {   // Train on evenly spaced slices, gathered in a pass over the input and 
+        // quantized like the output if -q or -I changed its type
+        mrczReader *reader = mrczReader_new( fh, header );
+        int quantize = outHeader->mrcType != header->mrcType;
+        size_t capacity = (size_t)dictionaryKB * 1024, sliceBytes = reader->sliceBytes;
+        size_t sliceItems = (size_t)header->dimensions[0] * header->dimensions[1];
+        uint32_t dz = header->dimensions[2], nSamples = dz, next = 0;
+        uint8_t *samples, *slice = NULL;
+        int64_t size;
+
+        if( quantize )
+        {   // The input slice is read aside and quantized into the samples
+            slice = malloc( sliceBytes );
+            sliceBytes = sliceItems * mrcHeader_itemsize( outHeader );
+        }
+
+        if( (uint64_t)sliceBytes * dz > (uint64_t)capacity * MRCZ_DICTIONARY_SAMPLES )
+        {
+            nSamples = (uint32_t)((uint64_t)capacity * MRCZ_DICTIONARY_SAMPLES / sliceBytes);
+            nSamples = nSamples > 0 ? nSamples : 1;
+        }
+        samples = malloc( (size_t)nSamples * sliceBytes );
+        for( uint32_t k = 0; k < dz && next < nSamples; k++ )
+        {   // Slices in between are read into the next free place
+            if( mrczReader_readSlice( reader, quantize ? slice : &samples[(size_t)next * sliceBytes] ) != 0 )
+                return -1;
+            if( quantize )
+                _quantizeFloats( (const float*)slice, &samples[(size_t)next * sliceBytes], sliceItems, 
+                                 outHeader->mrcType, outHeader->quantScale, outHeader->quantOffset );
+            if( k == (uint64_t)next * dz / nSamples )
+                next++;
+        }
+        free( slice );
+        mrczReader_free( reader );
+        fseek( fh, MRC_HEADER_LEN + header->extendedHeaderSize, SEEK_SET );
+
+        dictionary = malloc( capacity );
+        size = trainDictionaryMRCZ( samples, sliceBytes, nSamples, dictionary, capacity );
+        free( samples );
+        if( size > 0 )
+        {
+            outHeader->mrczFlags |= MRCZ_FLAG_DICTIONARY;
+            outHeader->dictionary = dictionary;
+            outHeader->dictionarySize = (int32_t)size;
+            printf( "%s: trained a %d-byte zstd dictionary from %u slices\n", inputName, (int)size, nSamples );
+        }
     }
     
-    
-    // OUTPUT WRITE/COMPRESS
-    fh = fopen( outputName, "wb" );
-    if( fh == NULL )
+    if( append )
+    {   // Compression options come from the existing file, except the level.
+        // Only the new data is read, so memory is proportional to it.
+        vol = mrcVolume_new( outHeader, NULL );
+        fseek( fh, 0, SEEK_SET );
+        if( ! readMRCZ( fh, vol, inputName ) )
+            return -1;
+        fclose( fh );
+
+        fh = fopen( outputName, "r+b" );
+        if( fh == NULL )
+        {
+            printf( "Error: could not open %s to append to.\n", outputName );
+            return -1;
+        }
+        if( appendMRCZ( fh, vol ) < 0 )
+        {
+            printf( "Error: could not append %s to %s.\n", inputName, outputName );
+            fclose( fh );
+            return -1;
+        }
+        fclose( fh );
+        return 0;
+    }
+
+    // OUTPUT TRANSCODE, streamed slice-by-slice so memory use is independent 
+    // of the volume size.
+    if( fhOut == NULL )
+        fhOut = fopen( outputName, "wb" );
+    if( fhOut == NULL )
     {
         printf( "Error: could not open %s to write.\n", outputName );
         return -1;
     }
-    fwrite_len = writeMRCZ( fh, vol );
-#ifndef NDEBUG
-    printf( "DEBUG: wrote %d bytes of data to disk.\n", fwrite_len );
-#endif
+    ret = transcodeMRCZ( fh, header, fhOut, outHeader );
+    fclose( fhOut );
     fclose( fh );
+    if( ret != 0 )
+    {
+        printf( "Error: failed to convert %s to %s.\n", inputName, outputName );
+        return -1;
+    }
 
 
     // Garbage collection (not necessary but this is an example of how to do it)
-    // Which is causing a seg-fault in some cases, why?
-    //mrcVolume_free( vol );
+    free( header );
+    free( outHeader );
+    free( dictionary );
+    free( inputDictionary );
     return 0;
 }
+#endif  /* MRCZ_LIBRARY */
@@ -86,6 +86,127 @@ extern "C" {
 #define BLOSC_DEFAULT_FILTER        BLOSC_BITSHUFFLE
 #define BLOSC_DEFAULT_CLEVEL        1
 
+// MRCZ extensions are stored in the unused 'extra' space of the header:
+//   112: float32 scale and 116: float32 offset of quantized float data
+//   120: int32 float mantissa bits kept by precision truncation
+//   124: float32 absolute error bound of precision truncation
+//   144: int32 bitmask of the optional MRCZ_FLAG_XXX features below
+//   148: int32 keyframe interval of the inter-slice predictor
+#define MRCZ_FLAG_CHECKSUM          0x1   // CRC32C of every chunk in the trailer
+#define MRCZ_FLAG_SPLITCOMPLEX      0x2   // complex64 slices stored as real then imaginary planes
+#define MRCZ_FLAG_DELTA             0x4   // slices stored as the difference to the previous slice
+#define MRCZ_FLAG_SPARSE            0x8   // mostly-zero slices may be stored as event lists
+#define MRCZ_FLAG_LOSSY             0x10  // float data was rounded by precision truncation
+#define MRCZ_FLAG_QUANTIZED         0x20  // integer data is float32 as value * quantScale + quantOffset
+#define MRCZ_FLAG_DICTIONARY        0x40  // chunks are zstd frames with the dictionary in the extended header
+
+// Precision truncation (MRCZ_FLAG_LOSSY) rounds float32 and complex64 data 
+// before compression so that the shuffle filters find runs of zero bits: 
+// keeping mantissaBits bounds the relative error to 2^-(mantissaBits+1), and 
+// absoluteError rounds to the largest power-of-two step within that bound.  
+// With both, each value is rounded once, to the finer of the two, so that 
+// both bounds hold.  
+// Readers need do nothing, the flag only records that the data is lossy.
+//
+// Quantization (MRCZ_FLAG_QUANTIZED) stores float32 data as int8, int16 or 
+// uint16, rounded from (value - quantOffset) / quantScale.  writeMRCZ does 
+// this for float32 volumes with the flag and header->quantizedType, choosing 
+// the scale and offset from the range of the data if quantScale is 0, and 
+// readMRCZ converts back with header->dequantize.  With header->detectIntegers 
+// writeMRCZ checks whether float32 data holds only whole numbers and, if so, 
+// quantizes it losslessly (quantScale 1, quantOffset 0) to the smallest of 
+// int8, int16 or uint16 that fits, which dequantizes back bit-exactly.
+
+// Flags describing how chunks are encoded, which are dropped when writing 
+// uncompressed data.
+#define MRCZ_CHUNK_FLAGS            (MRCZ_FLAG_CHECKSUM | MRCZ_FLAG_SPLITCOMPLEX | MRCZ_FLAG_DELTA | MRCZ_FLAG_SPARSE \
+                                     | MRCZ_FLAG_DICTIONARY)
+
+// With MRCZ_FLAG_DELTA every slice k with k % keyframeInterval == 0 is stored 
+// whole, so that any slice can be decoded from at most this many chunks.
+#define MRCZ_DEFAULT_KEYFRAMES      16
+
+// With MRCZ_FLAG_SPARSE a slice with fewer than this fraction of non-zero 
+// pixels is stored as an event list: {"MZSP", uint32 # of events}, the uint32 
+// gaps between the indices of successive events, then the event values.  Such 
+// chunks are recognized by blosc nbytes being smaller than a slice.
+#define MRCZ_SPARSE_MAGIC           "MZSP"
+#define MRCZ_SPARSE_HEADER_LEN      8
+#define MRCZ_DEFAULT_SPARSE_FILL    0.05
+
+// With MRCZ_FLAG_DICTIONARY (zstd only) a dictionary trained from sample 
+// slices is the extended header, marked "MZDI" in EXTTYP (byte 104), and every 
+// chunk is a 16-byte blosc-style header followed by a zstd frame compressed 
+// with it, or the raw bytes if that is no smaller (BLOSC_MEMCPYED).  blosc1 
+// cannot take a dictionary, so this needs libzstd (CMake USE_ZSTD_DICT).  
+// Tiny slices, e.g. particle stacks, gain the most.  The samples for training 
+// total at most MRCZ_DICTIONARY_SAMPLES times the size of the dictionary.
+#define MRCZ_DICTIONARY_EXTTYP      "MZDI"
+#define MRCZ_DEFAULT_DICTIONARY     (110*1024)
+#define MRCZ_DICTIONARY_SAMPLES     100
+
+// Machine stamp (first byte at 212): files are read in either byte order and 
+// always written in the order of the host.
+#define MRCZ_STAMP_LITTLE           0x44
+#define MRCZ_STAMP_BIG              0x11
+
+// Physical axes, as in mapColRowSlice, for reslicing
+#define MRCZ_AXIS_X                 1
+#define MRCZ_AXIS_Y                 2
+#define MRCZ_AXIS_Z                 3
+#define MRCZ_TRANSPOSE_TILE         32
+#define MRCZ_DEFAULT_RESLICE_MEMORY (256*1024*1024)
+
+// An MRCZ file may have a trailer after its last chunk, made of sections 
+// (a 16-byte mrczSection followed by its payload) and then a fixed 16-byte 
+// tail: {int64 offset of the first section, int32 # of sections, "MZTR"}.
+#define MRCZ_TRAILER_MAGIC          "MZTR"
+#define MRCZ_TRAILER_TAIL_LEN       16
+#define MRCZ_SECTION_CHUNKINDEX     "CIDX"
+
+// Overviews binned 2x2x2 per level are kept in a "PYRM" trailer section: 
+// count mrczPyramidLevel records, then the mrczChunkEntry index of every 
+// level in turn, then the chunks.  Each chunk is one plain blosc slice.
+#define MRCZ_SECTION_PYRAMID        "PYRM"
+#define MRCZ_MAX_PYRAMID_LEVELS     8
+
+/*
+mrczHistogram::
+
+  Optional histogram of the data, gathered slice by slice in the same loop 
+  that compresses (writeMRCZ) or decompresses (readMRCZ, readMRCZ_into) it 
+  when header->histogram points to one.  Values are counted in 16-bit keys: 
+  exactly for int8, int16 and uint16, and for float32 by the top 16 bits of 
+  their order-preserving bit pattern, i.e. to within 1 % of the value (NaN and 
+  infinity are left out).  Complex data is not counted.  Quantized data read 
+  with header->dequantize is counted in float32 units.  Every call starts over.
+  
+Functions::
+
+  mrczHistogram* mrczHistogram_new( int32_t nBins )
+    returns a histogram of nBins bins over [lo, hi], which are the range of 
+    the data unless set with lo < hi.  Values outside count in the end bins.
+    
+  double mrczHistogram_percentile( mrczHistogram *self, double percent )
+    returns the value below which percent (0-100) of the data lies.
+*/
+#define MRCZ_HISTOGRAM_KEYS         65536
+#define MRCZ_DEFAULT_BINS           256
+
+typedef struct _mrczHistogram
+{
+    int32_t nBins;
+    double lo, hi;            // range of the bins, that of the data if lo >= hi
+    uint64_t *counts;         // nBins counts over the range
+    uint64_t total;           // values counted
+    double min, max;          // range of the data
+    
+    // 'Private' counts per key, as values * scale + offset
+    int32_t mrcType;
+    double scale, offset;
+    uint64_t *keys;
+} mrczHistogram;
+
 /*
 mrcHeader::
 
@@ -129,14 +250,53 @@ typedef struct _mrcHeader
     
     // MRC2000 fields
     float origin;
-    uint8_t endian[2];   // TODO: not implemented yet.
+    uint8_t endian[2];   // machine stamp, MRCZ_STAMP_LITTLE or MRCZ_STAMP_BIG
     float std;
     
     float voltage;       // in keV
     float C3;            // aka spherical aberration in CEOS formulation
     float gain;          // counts/primary electron
+
+    // MRCZ extensions
+    uint32_t mrczFlags;  // MRCZ_FLAG_XXX bitmask, e.g. write chunk checksums
+    int32_t keyframeInterval;  // for MRCZ_FLAG_DELTA, 0 for the default
+    float sparseThreshold;     // for MRCZ_FLAG_SPARSE, 0 for the default (not stored)
+    int32_t numaAware;         // for readMRCZ(_into), decode with threads pinned per NUMA node (not stored)
+    int32_t pyramidLevels;     // 2x-binned overviews written after compressed data (in the trailer)
+    int32_t mantissaBits;      // float mantissa bits kept (1-22) on write, 0 for all 23
+    float absoluteError;       // float values rounded to within this on write, 0 for lossless
+    float quantScale;          // with MRCZ_FLAG_QUANTIZED, float = integer * quantScale + quantOffset
+    float quantOffset;
+    int32_t quantizedType;     // for writeMRCZ, the integer type to quantize float32 to (not stored)
+    int32_t dequantize;        // for readMRCZ, convert quantized data back to float32 (not stored)
+    int32_t detectIntegers;    // for writeMRCZ, store whole-numbered float32 as integers (not stored)
+    const uint8_t *dictionary; // with MRCZ_FLAG_DICTIONARY, zstd dictionary to write with, owned by the caller
+    int32_t dictionarySize;    // its size, or for writeMRCZ the size to train if dictionary is NULL
+    mrczHistogram *histogram;  // filled in by readMRCZ(_into) and writeMRCZ if set, owned by the caller (not stored)
 } mrcHeader;
 
+/*
+mrczAllocator::
+
+  Memory hooks for the data arrays of an mrcVolume.  A zeroed allocator (the 
+  default from mrcVolume_new) selects the built-in one, which aligns to 
+  MRCZ_ALIGNMENT bytes and advises the kernel to back large arrays with 
+  transparent hugepages.  With MRCZ_ALLOC_PREFAULT the pages are also touched 
+  up front, so that decompression does not stall on first-touch page faults.  
+  Custom hooks receive the opaque pointer, e.g. for a pooled allocator.
+*/
+#define MRCZ_ALIGNMENT              64
+#define MRCZ_HUGEPAGE_BYTES         (2*1024*1024)
+#define MRCZ_ALLOC_PREFAULT         0x1
+
+typedef struct _mrczAllocator
+{
+    void* (*malloc)( size_t nbytes, void *opaque );
+    void  (*free)( void *ptr, void *opaque );
+    void *opaque;
+    uint32_t flags;           // MRCZ_ALLOC_XXX bitmask
+} mrczAllocator;
+
 /*
 mrcVolume::
 
@@ -149,7 +309,9 @@ Functions::
  
   mrcVolume* mrcVolume_new( mrcHeader *header, void *in_array ) 
     returns an mrcVolume struct with allocated memory space. Either argument 
-    may be NULL.
+    may be NULL.  The volume takes ownership of in_array, which is released 
+    with vol->allocator.free (plain free() for the default allocator).  Set 
+    vol->allocator before readMRCZ() to control how the data is allocated.
     
   void* mrcVolume_data( mrcVolume *vol )
     returns the valid pointer to the active array, according to header->mrcType.
@@ -162,6 +324,24 @@ Functions::
   
   mrcVolume_free( mrcVolume *vol ) 
     cleans up all memory allocated to the mrcVolume struct.
+
+  mrcVolume* mrcVolume_open( FILE *fh, char *filename, size_t cacheBytes, int readAhead )
+    returns a lazy volume that reads only the header and chunk index.  Slices 
+    are decompressed on demand by mrcVolume_slice() and kept in an LRU cache 
+    of about cacheBytes, and a miss also decompresses the next readAhead 
+    slices.  fh must stay open until mrcVolume_free().  mrcVolume_data() is 
+    NULL for a lazy volume.
+
+  const void* mrcVolume_slice( mrcVolume *vol, uint32_t k )
+    returns slice k of a lazy volume, decompressing it if it is not cached, 
+    or NULL on error.  The slice is pinned in the cache until the matching 
+    mrcVolume_releaseSlice( vol, k ).  Safe to call from many threads, as 
+    long as the cache has more slices than the callers hold pinned.
+
+  int writeMRCZ( FILE *fh, mrcVolume *vol )
+    writes vol as set out by vol->header (compressor, flags, ...) from the 
+    current position of fh.  Returns 0 on success, or -1 if the header, any 
+    slice or the chunk index and trailer could not be written.
 */
 typedef struct _mrcVolume
 {
@@ -181,21 +361,282 @@ typedef struct _mrcVolume
     float complex  *_c8;
 #endif
 
-    
+    mrczAllocator allocator;
+    struct _mrczSliceCache *cache;  // lazy volumes from mrcVolume_open() only
 } mrcVolume;
 
 
+/*
+mrczSection::
+
+  Header of one section in the MRCZ trailer, followed by bytes of payload.
+
+mrczChunkEntry::
+
+  One entry of the "CIDX" chunk index section: the absolute file position, 
+  compressed size and CRC32C of the blosc chunk holding one z-slice.
+
+mrczPyramidLevel::
+
+  Shape of one overview level of the "PYRM" section.  Level L is binned by 
+  2^L along each axis, rounding up.
+*/
+typedef struct _mrczSection
+{
+    char tag[4];
+    uint32_t count;
+    uint64_t bytes;
+} mrczSection;
+
+typedef struct _mrczChunkEntry
+{
+    uint64_t offset;
+    uint32_t cbytes;
+    uint32_t crc32c;
+} mrczChunkEntry;
+
+typedef struct _mrczPyramidLevel
+{
+    int32_t dimensions[3];
+    int32_t reserved;
+} mrczPyramidLevel;
+
+/*
+mrczReader::
+mrczWriter::
+
+  Stream the z-slices of a file one at a time, so that memory use is one 
+  slice regardless of the size of the volume.  Both handle compressed and 
+  uncompressed files according to header->blosc_compressor.
+
+Functions::
+
+  mrczReader* mrczReader_new( FILE *fh, mrcHeader *header )
+    header must be parsed (e.g. by readMRCZHeader) and fh must point to the 
+    start of the data.
+    
+  int mrczReader_readSlice( mrczReader *self, void *dest )
+    reads the next slice into dest, which holds self->sliceBytes.  Returns 0 
+    on success.
+    
+  mrczWriter* mrczWriter_new( FILE *fh, mrcHeader *header )
+    fh must point to the start of the data, i.e. after the header.
+    
+  int mrczWriter_writeSlice( mrczWriter *self, const void *src )
+    compresses and writes the next slice.  Returns 0 on success.
+
+  int mrczWriter_writeFloatSlice( mrczWriter *self, const float *src )
+    quantizes a float32 slice into the integer type of a writer whose header 
+    has MRCZ_FLAG_QUANTIZED, quantScale and quantOffset, and writes it.
+    
+  int mrczWriter_free( mrczWriter *self )
+    writes the trailer, if any, and frees the writer.
+
+  With header->pyramidLevels the writer also bins every slice into that many 
+  2x, 4x, ... overviews in the same pass, and stores them in the trailer.  
+  Only for compressed files.
+
+  A reader of a file with MRCZ_FLAG_DICTIONARY loads the dictionary from the 
+  extended header, unless header->dictionary is set.  A writer uses 
+  header->dictionary, which _writeHeader has stored in the file.
+*/
+typedef struct _mrczReader
+{
+    FILE *fh;
+    mrcHeader *header;
+    size_t sliceBytes;
+    uint32_t next;            // index of the next slice
+    uint8_t *bloscRepr;
+    size_t bloscCapacity;
+    uint8_t *scratch;         // slice before undoing the MRCZ filters
+    uint8_t *prev;            // previous slice, for the inter-slice predictor
+    uint8_t *events;          // event list of a sparse slice
+    uint32_t *crcs;           // checksums of the chunks read, if the file has an index
+    const mrczChunkEntry *entries;  // if set, chunks are located and checked with the index
+    void *ioLock;             // if set, a pthread_mutex_t shared by the readers of fh
+    size_t swapWidth;         // word size to byte-swap, 0 if the file is in host order
+    uint8_t *dictionary;      // loaded from the extended header, with MRCZ_FLAG_DICTIONARY
+    void *zstd;               // ZSTD_DCtx and ZSTD_DDict for dictionary chunks
+    void *zstdDict;
+} mrczReader;
+
+/*
+mrczPyramid::
+
+  Overviews binned by an mrczWriter while it writes the slices, see 
+  header->pyramidLevels.  The compressed overview slices are kept in a 
+  temporary file until the trailer is written.
+*/
+typedef struct _mrczPyramid
+{
+    mrcHeader *header;
+    int nLevels;
+    mrczPyramidLevel levels[MRCZ_MAX_PYRAMID_LEVELS+1];  // [0] is the volume itself
+    uint32_t next[MRCZ_MAX_PYRAMID_LEVELS+1];    // slices of each level binned so far
+    float *sums[MRCZ_MAX_PYRAMID_LEVELS+1];      // running 2x2x2 sums of each overview slice
+    uint8_t *slices[MRCZ_MAX_PYRAMID_LEVELS+1];  // a finished overview slice
+    mrczChunkEntry *entries[MRCZ_MAX_PYRAMID_LEVELS+1];  // offsets into chunks
+    uint8_t *bloscRepr;
+    size_t bloscCapacity;
+    FILE *chunks;             // compressed overview slices, until the trailer
+    int64_t chunkBytes;
+} mrczPyramid;
+
+typedef struct _mrczWriter
+{
+    FILE *fh;
+    mrcHeader *header;
+    size_t sliceBytes;
+    uint32_t next;            // index of the next slice
+    int64_t chunkPos;         // file position of the next chunk
+    uint8_t *bloscRepr;
+    size_t bloscCapacity;
+    uint8_t *scratch;         // slice after applying the MRCZ filters
+    uint8_t *prev;            // previous slice, for the inter-slice predictor
+    uint8_t *residual;
+    uint8_t *events;          // event list of a sparse slice
+    uint8_t *values;
+    uint8_t *rounded;         // slice after precision truncation
+    uint8_t *quantized;       // slice from mrczWriter_writeFloatSlice
+    mrczChunkEntry *entries;  // chunk index, if checksums are written
+    mrczPyramid *pyramid;     // overviews being binned, if header->pyramidLevels
+    void *zstd;               // ZSTD_CCtx and ZSTD_CDict, if writing with header->dictionary
+    void *zstdDict;
+} mrczWriter;
+
+/*
+mrczSliceCache::
+
+  LRU cache of decompressed slices behind a lazy mrcVolume.  Hits only take 
+  lock; misses are decoded one at a time under decodeLock by a single 
+  mrczReader, which continues sequentially when it can.
+*/
+typedef struct _mrczCacheSlot
+{
+    int64_t k;                // slice held, or -1
+    uint8_t *data;
+    uint64_t lastUse;
+    int32_t pins;
+} mrczCacheSlot;
+
+typedef struct _mrczSliceCache
+{
+    mrczReader *reader;
+    mrczChunkEntry *entries;
+    mrczCacheSlot *slots;
+    int nSlots;
+    int readAhead;
+    uint64_t clock;
+    uint8_t *discard;         // slices decoded on the way to a delta-coded one
+    void *lock;               // pthread_mutex_t
+    void *decodeLock;
+} mrczSliceCache;
+
+/*
+mrczShmDescriptor::
+
+  Start of a POSIX shared-memory segment made by readMRCZ_shm().  The 
+  uncompressed data of the slices follows at MRCZ_SHM_DATA_OFFSET, and header 
+  is an uncompressed standard header with the dimensions of those slices.  
+  ready is set last, once the data is complete.
+
+Functions::
+
+  int readMRCZ_shm( FILE *fh, char *filename, const char *shmName, uint32_t first, uint32_t count )
+    decompresses count slices (0 for the rest) starting at first into a new 
+    segment shmName.  Returns 0 on success.
+
+  mrcVolume* mrcVolume_attach( const char *shmName )
+    maps the segment read-only as a volume without copying, until 
+    mrcVolume_free().
+
+  int mrczShm_unlink( const char *shmName )
+    removes the segment once every process has attached to it.
+*/
+#define MRCZ_SHM_MAGIC              "MRCZSHM"
+#define MRCZ_SHM_DATA_OFFSET        4096
+
+typedef struct _mrczShmDescriptor
+{
+    char magic[8];
+    uint64_t totalBytes;      // of the segment
+    uint32_t first;           // first slice taken from the file
+    volatile int32_t ready;
+    uint8_t header[MRC_HEADER_LEN];
+} mrczShmDescriptor;
+
+/*
+mrczFileInfo::
+
+  Result of a header-only scan of one file, see scanMRCZ().  fileBytes is the 
+  size on disk, dataBytes the (possibly compressed) size of the data section 
+  and rawBytes the uncompressed size of the data.  status is 0 if the file 
+  parsed as a valid MRC/MRCZ file.
+*/
+typedef struct _mrczFileInfo
+{
+    char *filename;
+    mrcHeader header;
+    int64_t fileBytes;
+    int64_t dataBytes;
+    int64_t rawBytes;
+    int status;
+} mrczFileInfo;
+
+
 /* 
   Public library functions 
+
+  The library is reentrant: it keeps no global state and calls only the 
+  context-free blosc_compress_ctx()/blosc_decompress_ctx(), so there is no 
+  need for blosc_init().  Different files may be read and written from 
+  different threads at once.  A FILE, mrcHeader, mrcVolume, mrczReader or 
+  mrczWriter must only be used by one thread at a time.
 */
 mrcHeader*   mrcHeader_new();
 
-mrcVolume*   new_mrcVolume( mrcHeader *header, void *data );
+size_t       mrcHeader_itemsize( mrcHeader *self );
+
+mrcVolume*   mrcVolume_new( mrcHeader *header, void *data );
+void*        mrcVolume_data( mrcVolume *self );
 size_t       mrcVolume_itemsize( mrcVolume *self );
 void         mrcVolume_free( mrcVolume *self );
+mrcVolume*   mrcVolume_open( FILE *fh, char *filename, size_t cacheBytes, int readAhead );
+const void*  mrcVolume_slice( mrcVolume *self, uint32_t k );
+void         mrcVolume_releaseSlice( mrcVolume *self, uint32_t k );
 
+int          readMRCZHeader( FILE *fh, mrcHeader *header, char *filename );
 int          readMRCZ( FILE *fh, mrcVolume *dest, char *filename );
+size_t       peekMRCZ( FILE *fh, mrcHeader *header, char *filename );
+int          readMRCZ_into( FILE *fh, mrcHeader *header, void *buf, size_t bufsize );
+int          readMRCZ_level( FILE *fh, mrcVolume *dest, int level, char *filename );
+int          readMRCZ_shm( FILE *fh, char *filename, const char *shmName, uint32_t first, uint32_t count );
+mrcVolume*   mrcVolume_attach( const char *shmName );
+int          mrczShm_unlink( const char *shmName );
 int          writeMRCZ( FILE *fh, mrcVolume *vol );
+int          verifyMRCZ( FILE *fh, mrcHeader *header, char *filename );
+int          appendMRCZ( FILE *fh, mrcVolume *vol );
+int          catMRCZ( FILE *fhOut, FILE **fhIn, char **inNames, int nIn );
+int          splitMRCZ( FILE *fhIn, char *inName, FILE *fhOut, uint32_t first, uint32_t count );
+int          resliceMRCZ( FILE *fhIn, mrcHeader *inHeader, FILE *fhOut, mrcHeader *outHeader, int axis, size_t memoryBytes );
+int          reslicePlaneMRCZ( FILE *fhIn, mrcHeader *header, int axis, uint32_t index, void *dest );
+int          transcodeMRCZ( FILE *fhIn, mrcHeader *inHeader, FILE *fhOut, mrcHeader *outHeader );
+int64_t      trainDictionaryMRCZ( const void *slices, size_t sliceBytes, uint32_t nSlices, 
+                                  uint8_t *dictionary, size_t capacity );
+
+mrczReader*  mrczReader_new( FILE *fh, mrcHeader *header );
+int          mrczReader_readSlice( mrczReader *self, void *dest );
+void         mrczReader_free( mrczReader *self );
+mrczWriter*  mrczWriter_new( FILE *fh, mrcHeader *header );
+int          mrczWriter_writeSlice( mrczWriter *self, const void *src );
+int          mrczWriter_writeFloatSlice( mrczWriter *self, const float *src );
+int          mrczWriter_free( mrczWriter *self );
+
+int          scanMRCZ( mrczFileInfo *infos, int nFiles, int n_threads );
+
+mrczHistogram* mrczHistogram_new( int32_t nBins );
+double       mrczHistogram_percentile( mrczHistogram *self, double percent );
+void         mrczHistogram_free( mrczHistogram *self );
 
 int          getNumCPU();
 
@@ -205,10 +646,80 @@ int          getNumCPU();
   change arbitrarily in the future. 
 */
 int _parseStandardHeader( uint8_t *headerBytes, mrcHeader *header, char *filename );
-uint8_t* _buildStandardHeader( FILE *fh, mrcHeader *header );
+void _buildStandardHeader( mrcHeader *header, uint8_t *headerBytes );
+int _writeHeader( FILE *fh, mrcHeader *header );
+int _skipExtendedHeader( FILE *fh, mrcHeader *header, uint8_t **extended );
 int _loadUncompressedMRC( FILE *fh, mrcVolume *dest );
 int _decompressMRCZ( FILE *fh, mrcVolume *dest );
+int _decompressInto( FILE *fh, mrcHeader *header, uint8_t *bytesRepr, int prefault );
 int _compressMRCZ( FILE *fh, mrcVolume *source );
+int _loadChunkIndex( FILE *fh, mrcHeader *header, mrczChunkEntry **entries, int64_t *trailerStart );
+void _accumulateStats( const void *data, int32_t mrcType, size_t n, double *min, double *max, 
+                       double *sum, double *sumsq );
+void _histogramSlice( uint64_t *keys, int32_t mrcType, const void *data, size_t n );
+void _histogramStart( mrczHistogram *self, mrcHeader *header );
+void _histogramFinish( mrczHistogram *self );
+const char* _compressorName( int32_t compressor );
+int32_t _compressorCode( const char *name );
+int _validHeader( mrcHeader *header );
+void _parallelFor( int64_t nItems, int n_threads, void (*func)( void *arg, int64_t index ), void *arg );
+int _listFiles( const char *path, char ***names, int *nNames, int *capacity );
+uint32_t _crc32c( uint32_t crc, const void *buf, size_t len );
+int _readChunk( FILE *fh, uint8_t **bloscRepr, size_t *capacity );
+int _writeTrailer( FILE *fh, int64_t trailerStart, mrczChunkEntry *entries, uint32_t nChunks, 
+                   mrczPyramid *pyramid );
+int _findSection( FILE *fh, const char *tag, mrczSection *section );
+int _truncateFile( FILE *fh );
+mrczPyramid* _mrczPyramid_new( mrcHeader *header );
+int _mrczPyramid_add( mrczPyramid *self, int level, const void *src );
+int _mrczPyramid_write( mrczPyramid *self, FILE *fh, int64_t pos );
+void _mrczPyramid_free( mrczPyramid *self );
+int _checkChunkIndex( FILE *fh, uint32_t *crcs, uint32_t nChunks, char *filename );
+void _splitComplex( const float *src, float *dest, size_t n );
+void _mergeComplex( const float *src, float *dest, size_t n );
+size_t _filteredItemsize( mrcHeader *header );
+int _hostIsBigEndian( void );
+size_t _swapWidth( mrcHeader *header );
+void _byteSwap( uint8_t *data, size_t nbytes, size_t width );
+int32_t _keyframeInterval( mrcHeader *header );
+int _isLossy( mrcHeader *header );
+int _quantizeRange( int32_t mrcType, float *lo, float *hi );
+int _chooseQuantization( mrcHeader *header, double min, double max );
+void _quantizeFloats( const float *src, void *dest, size_t n, int32_t mrcType, float scale, float offset );
+void _dequantize( const void *src, float *dest, size_t n, int32_t mrcType, float scale, float offset );
+int _quantizedHeader( mrcHeader *header, mrcHeader *stored, double min, double max );
+int _writeQuantized( FILE *fh, mrcHeader *header, const float *data );
+int _floatsAreIntegers( const float *src, size_t n, double *min, double *max );
+int32_t _integerTypeFor( double min, double max );
+int _detectIntegerType( mrcHeader *header, const float *data );
+int _hasDictionary( mrcHeader *header );
+uint8_t* _loadDictionary( FILE *fh, mrcHeader *header );
+int _trainVolumeDictionary( mrcHeader *header, const uint8_t *data, uint8_t **dictionary );
+int _compressDictChunk( mrczWriter *self, size_t typesize, size_t nbytes, const void *src );
+int _decompressChunk( mrczReader *self, void *dest, size_t destBytes );
+int _dequantizeVolume( mrcVolume *vol );
+void _truncatePrecision( const float *src, float *dest, size_t n, int32_t mantissaBits, float absoluteError );
+void _deltaEncode( const uint8_t *cur, uint8_t *prev, uint8_t *residual, size_t nbytes, size_t itemsize );
+void _deltaDecode( const uint8_t *residual, uint8_t *prev, uint8_t *cur, size_t nbytes, size_t itemsize );
+void _mrczReader_seek( mrczReader *self, uint32_t k, int64_t offset );
+int _mrczSliceCache_load( mrczSliceCache *self, uint32_t k, int readAhead );
+void _mrczSliceCache_free( mrczSliceCache *self );
+int _mrczWriter_copyChunk( mrczWriter *self, const uint8_t *chunk, int cbytes );
+int _copyExtendedHeader( FILE *fhIn, mrcHeader *inHeader, FILE *fhOut );
+int _copySlices( FILE *fhIn, mrcHeader *inHeader, mrczChunkEntry *index, uint32_t first, uint32_t count, 
+                 mrczWriter *writer, int verbatim );
+int _splitRange( FILE *fhIn, mrcHeader *header, mrczChunkEntry *entries, uint8_t *dictionary, 
+                 FILE *fhOut, uint32_t first, uint32_t count );
+int _loadSplitInput( FILE *fhIn, char *inName, mrcHeader *header, mrczChunkEntry **entries, uint8_t **dictionary );
+int _resliceRole( mrcHeader *header, int axis, int map[3] );
+int _readSliceRange( FILE *fh, mrcHeader *header, uint32_t first, uint32_t count, uint8_t *dest );
+int _decompressNUMA( FILE *fh, mrcHeader *header, uint8_t *bytesRepr, int prefault );
+void* _alignedMalloc( size_t nbytes, void *opaque );
+void _alignedFree( void *ptr, void *opaque );
+uint8_t* _mrcVolume_alloc( mrcVolume *self, size_t nbytes );
+int64_t _encodeEvents( const uint8_t *slice, size_t nbytes, size_t itemsize, uint32_t maxEvents, 
+                       uint8_t *events, uint8_t *values );
+int _decodeEvents( const uint8_t *events, size_t eventBytes, uint8_t *slice, size_t nbytes, size_t itemsize );
 void _print_help();
 
 #ifdef __cplusplus
@@ -0,0 +1,127 @@
+/*********************************************************************
+  appendMRCZ() onto files written with checksums and with the delta filter.
+
+  A volume A is written, a volume B is appended to it in place, and the
+  file must read back as A followed by B and verify clean against the
+  rewritten chunk index.
+
+  See LICENSE.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mrcz.h"
+
+static const int32_t _flags[] = { MRCZ_FLAG_CHECKSUM, MRCZ_FLAG_DELTA | MRCZ_FLAG_CHECKSUM };
+static const int32_t _types[] = { MRC_INT16, MRC_FLOAT32 };
+
+static mrcVolume* _volume( int32_t mrcType, int32_t flags, int32_t dz, uint8_t **copy )
+{   // A smooth volume of dz slices with a copy of its data in *copy
+    mrcHeader *header = mrcHeader_new();
+    size_t nitems, nbytes;
+    uint8_t *data;
+
+    header->mrcType = mrcType;
+    header->blosc_compressor = BLOSC_COMPRESSOR_LZ4;
+    header->mrczFlags = flags;
+    header->blosc_threads = 1;
+    header->dimensions[0] = 32;
+    header->dimensions[1] = 24;
+    header->dimensions[2] = dz;
+    nitems = (size_t)32 * 24 * dz;
+    nbytes = nitems * mrcHeader_itemsize( header );
+
+    data = malloc( nbytes );
+    for( size_t j = 0; j < nitems; j++ )
+    {
+        if( mrcType == MRC_INT16 )
+            ((int16_t*)data)[j] = (int16_t)(j % 97 + rand() % 8);
+        else
+            ((float*)data)[j] = (float)(j % 53) * 0.25f + (float)(rand() % 8);
+    }
+    *copy = malloc( nbytes );
+    memcpy( *copy, data, nbytes );
+    return mrcVolume_new( header, data );
+}
+
+static int _append( int32_t mrcType, int32_t flags )
+{
+    const char *filename = "test_append.mrcz";
+    mrcVolume *first, *second, *loaded;
+    mrcHeader *header = mrcHeader_new();
+    uint8_t *firstData, *secondData;
+    size_t firstBytes, secondBytes;
+    FILE *fh;
+    int nBad, failed = 0;
+
+    first = _volume( mrcType, flags, 3, &firstData );
+    second = _volume( mrcType, flags, 2, &secondData );
+    firstBytes = (size_t)32 * 24 * 3 * mrcVolume_itemsize( first );
+    secondBytes = (size_t)32 * 24 * 2 * mrcVolume_itemsize( second );
+
+    fh = fopen( filename, "wb" );
+    if( fh == NULL || writeMRCZ( fh, first ) != 0 || fclose( fh ) != 0 )
+    {
+        printf( "Error: writeMRCZ failed for type %d, flags %d\n", mrcType, flags );
+        failed = 1;
+        goto cleanup;
+    }
+    fh = fopen( filename, "r+b" );
+    if( fh == NULL || appendMRCZ( fh, second ) != 2 || fclose( fh ) != 0 )
+    {
+        printf( "Error: appendMRCZ failed for type %d, flags %d\n", mrcType, flags );
+        failed = 1;
+        goto cleanup;
+    }
+
+    loaded = mrcVolume_new( NULL, NULL );
+    fh = fopen( filename, "rb" );
+    if( fh == NULL || !readMRCZ( fh, loaded, (char*)filename )
+        || loaded->header->dimensions[2] != 5
+        || memcmp( mrcVolume_data( loaded ), firstData, firstBytes ) != 0
+        || memcmp( (uint8_t*)mrcVolume_data( loaded ) + firstBytes, secondData, secondBytes ) != 0 )
+    {
+        printf( "Error: appended file does not read back as both volumes for type %d, flags %d\n",
+                mrcType, flags );
+        failed = 1;
+    }
+    if( fh != NULL )
+        fclose( fh );
+    mrcVolume_free( loaded );
+
+    fh = fopen( filename, "rb" );
+    nBad = fh == NULL ? -2 : verifyMRCZ( fh, header, (char*)filename );
+    if( nBad != 0 )
+    {
+        printf( "Error: appended file for type %d, flags %d verified to %d, not 0\n", mrcType, flags, nBad );
+        failed = 1;
+    }
+    if( fh != NULL )
+        fclose( fh );
+
+cleanup:
+    remove( filename );
+    free( header );
+    free( firstData );
+    free( secondData );
+    mrcVolume_free( first );
+    mrcVolume_free( second );
+    return failed;
+}
+
+int main( void )
+{
+    int failures = 0, n = 0;
+
+    srand( 28 );
+    for( int f = 0; f < 2; f++ )
+    {
+        for( int t = 0; t < 2; t++, n++ )
+            failures += _append( _types[t], _flags[f] );
+    }
+    printf( "test_append: %d appended files, %d failures\n", n, failures );
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+/*********************************************************************
+  Chunk checksums (MRCZ_FLAG_CHECKSUM) against a corrupted file.
+
+  A volume is written with checksums and must verify clean.  Then one byte
+  inside the compressed data of a chunk is flipped, after which verifyMRCZ()
+  must count a bad chunk and readMRCZ() must fail rather than return the
+  damaged slice.
+
+  See LICENSE.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mrcz.h"
+
+static const int32_t _compressors[] = { BLOSC_COMPRESSOR_LZ4, BLOSC_COMPRESSOR_ZLIB };
+
+static int _verify( const char *filename )
+{   // verifyMRCZ() of a file by name, or -2 if it cannot be opened
+    mrcHeader *header = mrcHeader_new();
+    FILE *fh = fopen( filename, "rb" );
+    int nBad = -2;
+
+    if( fh != NULL )
+    {
+        nBad = verifyMRCZ( fh, header, (char*)filename );
+        fclose( fh );
+    }
+    free( header );
+    return nBad;
+}
+
+static int _corrupt( int32_t compressor, long offset )
+{   // offset counts from the start of the compressed data of the first chunk
+    const char *filename = "test_checksum.mrcz";
+    mrcHeader *header = mrcHeader_new();
+    mrcVolume *source, *loaded;
+    size_t nbytes;
+    int16_t *data;
+    FILE *fh;
+    int c, nBad, failed = 0;
+
+    header->mrcType = MRC_INT16;
+    header->blosc_compressor = compressor;
+    header->mrczFlags = MRCZ_FLAG_CHECKSUM;
+    header->blosc_threads = 1;
+    header->dimensions[0] = 64;
+    header->dimensions[1] = 64;
+    header->dimensions[2] = 4;
+    nbytes = (size_t)64 * 64 * 4 * sizeof(int16_t);
+
+    // Noisy data, so that every chunk holds compressed bytes well past offset
+    data = malloc( nbytes );
+    srand( 37 );
+    for( size_t j = 0; j < nbytes / sizeof(int16_t); j++ )
+        data[j] = (int16_t)(rand() % 2000 - 1000);
+    source = mrcVolume_new( header, data );
+
+    fh = fopen( filename, "wb" );
+    if( fh == NULL || writeMRCZ( fh, source ) != 0 || fclose( fh ) != 0 )
+    {
+        printf( "Error: writeMRCZ failed for compressor %d\n", compressor );
+        mrcVolume_free( source );
+        return 1;
+    }
+
+    nBad = _verify( filename );
+    if( nBad != 0 )
+    {
+        printf( "Error: untouched file with compressor %d verified to %d, not 0\n", compressor, nBad );
+        failed = 1;
+    }
+
+    // Flip every bit of one byte past the 16-byte blosc header of slice 0
+    offset += MRC_HEADER_LEN + header->extendedHeaderSize + 16;
+    fh = fopen( filename, "r+b" );
+    if( fh == NULL || fseek( fh, offset, SEEK_SET ) != 0 || (c = fgetc( fh )) == EOF
+        || fseek( fh, offset, SEEK_SET ) != 0 || fputc( c ^ 0xFF, fh ) == EOF || fclose( fh ) != 0 )
+    {
+        printf( "Error: could not corrupt byte %ld of %s\n", offset, filename );
+        mrcVolume_free( source );
+        return 1;
+    }
+
+    nBad = _verify( filename );
+    if( nBad <= 0 )
+    {
+        printf( "Error: corrupt byte %ld with compressor %d verified to %d, not >0\n", offset, compressor, nBad );
+        failed = 1;
+    }
+
+    loaded = mrcVolume_new( NULL, NULL );
+    fh = fopen( filename, "rb" );
+    if( fh == NULL || readMRCZ( fh, loaded, (char*)filename ) )
+    {
+        printf( "Error: readMRCZ accepted corrupt byte %ld with compressor %d\n", offset, compressor );
+        failed = 1;
+    }
+    if( fh != NULL )
+        fclose( fh );
+
+    remove( filename );
+    mrcVolume_free( loaded );
+    mrcVolume_free( source );
+    return failed;
+}
+
+int main( void )
+{
+    int failures = 0, n = 0;
+
+    for( int c = 0; c < 2; c++ )
+    {
+        for( long offset = 0; offset < 256; offset += 85, n++ )
+            failures += _corrupt( _compressors[c], offset );
+    }
+    printf( "test_checksum: %d corrupted files, %d failures\n", n, failures );
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,385 @@
+/*********************************************************************
+  Throughput regression gate for the c-mrcz library.
+
+  Times the per-slice compress and decompress paths (mrczWriter_writeSlice
+  and mrczReader_readSlice) for lz4 and zstd, the 1024-byte header build and
+  parse, and readMRCZ of an uncompressed file, on one blosc thread so that
+  the numbers do not depend on the number of cores.  Each repeat runs its
+  benchmark over and over for at least MIN_SECONDS of wall-clock time, and
+  the rate reported is the median of the repeats.  Every round trip is also
+  compared once against the data written.
+
+  Rates are compared to a baseline file of "name rate" lines and the test
+  fails if any drops by more than the tolerance (default: 0.25, i.e. 25 %),
+  or if the baseline is missing or lacks a benchmark.  -u records all of
+  them in the baseline instead, on the first run on a machine or after an
+  intended change.
+
+    test_perf -b <baseline file> [-t <tolerance>] [-u]
+
+  See LICENSE.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mrcz.h"
+
+#define N_REPEATS           5
+#define MIN_SECONDS         0.2
+#define N_HEADERS           1000      // per pass of header_build_parse
+#define MAX_BENCHMARKS      16
+#define DEFAULT_TOLERANCE   0.25
+
+typedef struct _benchmark
+{
+    char name[32];
+    double rate;          // MB/s, or headers/s
+    double baseline;      // 0 if not in the baseline file
+} benchmark;
+
+typedef struct _sliceBench
+{
+    FILE *fh;
+    mrcHeader *header;
+    mrcHeader *readHeader;
+    float *data;
+    float *slice;
+    size_t sliceItems;
+} sliceBench;
+
+typedef struct _loadBench
+{
+    FILE *fh;
+    mrcVolume *loaded;    // of the last pass
+} loadBench;
+
+// One pass of a benchmark, 0 on success
+typedef int (*benchPass)( void *context );
+
+static benchmark _benchmarks[MAX_BENCHMARKS];
+static int _nBenchmarks = 0;
+
+static double _now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static int _compareRates( const void *a, const void *b )
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static int _measure( const char *name, benchPass pass, void *context, double workPerPass )
+{   // Median of N_REPEATS rates, each over as many passes as fit in MIN_SECONDS
+    double rates[N_REPEATS], t, start;
+    benchmark *b;
+
+    for( int r = 0; r < N_REPEATS; r++ )
+    {
+        int64_t passes = 0;
+        start = _now();
+        do
+        {
+            if( pass( context ) != 0 )
+            {
+                printf( "Error: benchmark %s failed\n", name );
+                return -1;
+            }
+            passes++;
+            t = _now() - start;
+        } while( t < MIN_SECONDS );
+        rates[r] = passes * workPerPass / t;
+    }
+    qsort( rates, N_REPEATS, sizeof(double), _compareRates );
+
+    b = &_benchmarks[_nBenchmarks++];
+    snprintf( b->name, sizeof(b->name), "%s", name );
+    b->rate = rates[N_REPEATS / 2];
+    b->baseline = 0.0;
+    return 0;
+}
+
+static mrcHeader* _movieHeader( int32_t compressor )
+{   // A float32 stack of low-dose counting frames, like an aligned movie
+    mrcHeader *header = mrcHeader_new();
+    header->mrcType = MRC_FLOAT32;
+    header->blosc_compressor = compressor;
+    header->blosc_threads = 1;
+    header->dimensions[0] = 1024;
+    header->dimensions[1] = 1024;
+    header->dimensions[2] = 16;
+    return header;
+}
+
+static float* _movieData( mrcHeader *header )
+{
+    size_t n = (size_t)header->dimensions[0] * header->dimensions[1] * header->dimensions[2];
+    float *data = malloc( n * sizeof(float) );
+    uint32_t state = 12345u;
+    for( size_t i = 0; i < n; i++ )
+    {
+        state = state * 1664525u + 1013904223u;
+        data[i] = (float)((state >> 24) % 5 == 0 ? 1 + (state >> 8) % 3 : 0);
+    }
+    return data;
+}
+
+static int _writeSlices( void *context )
+{   // Compress the movie slice by slice over the previous pass
+    sliceBench *s = (sliceBench*)context;
+    mrczWriter *writer;
+    int ret = 0;
+
+    rewind( s->fh );
+    if( _writeHeader( s->fh, s->header ) != 0 )
+        return -1;
+    writer = mrczWriter_new( s->fh, s->header );
+    if( writer == NULL )
+        return -1;
+    for( int32_t k = 0; k < s->header->dimensions[2] && ret == 0; k++ )
+        ret = mrczWriter_writeSlice( writer, &s->data[k * s->sliceItems] );
+    if( mrczWriter_free( writer ) != 0 )
+        ret = -1;
+    return ret;
+}
+
+static int _readSlices( sliceBench *s, int verify )
+{   // Decompress slice by slice, comparing each to the source if verify is set
+    mrczReader *reader;
+    int ret = 0;
+
+    rewind( s->fh );
+    if( readMRCZHeader( s->fh, s->readHeader, "test_perf" ) != 0 )
+        return -1;
+    s->readHeader->blosc_threads = 1;
+    if( fseek( s->fh, MRC_HEADER_LEN + s->readHeader->extendedHeaderSize, SEEK_SET ) != 0 )
+        return -1;
+    reader = mrczReader_new( s->fh, s->readHeader );
+    if( reader == NULL )
+        return -1;
+    for( int32_t k = 0; k < s->readHeader->dimensions[2] && ret == 0; k++ )
+    {
+        ret = mrczReader_readSlice( reader, s->slice );
+        if( ret == 0 && verify
+            && memcmp( s->slice, &s->data[k * s->sliceItems], s->sliceItems * sizeof(float) ) != 0 )
+        {
+            printf( "Error: slice %d differs from the one written\n", k );
+            ret = -1;
+        }
+    }
+    mrczReader_free( reader );
+    return ret;
+}
+
+static int _readSlicesPass( void *context )
+{
+    return _readSlices( (sliceBench*)context, 0 );
+}
+
+static int _benchSlices( const char *label, int32_t compressor )
+{   // Both timed on the uncompressed bytes
+    sliceBench s;
+    double mb;
+    char name[32];
+    int ret = -1;
+
+    s.header = _movieHeader( compressor );
+    s.readHeader = mrcHeader_new();
+    s.data = _movieData( s.header );
+    s.sliceItems = (size_t)s.header->dimensions[0] * s.header->dimensions[1];
+    s.slice = malloc( s.sliceItems * sizeof(float) );
+    s.fh = tmpfile();
+    mb = s.sliceItems * s.header->dimensions[2] * sizeof(float) / 1e6;
+
+    if( s.fh == NULL )
+        printf( "Error: could not create a temporary file\n" );
+    else
+    {
+        snprintf( name, sizeof(name), "write_slice_%s", label );
+        if( _measure( name, _writeSlices, &s, mb ) == 0 )
+        {
+            snprintf( name, sizeof(name), "read_slice_%s", label );
+            if( _readSlices( &s, 1 ) != 0 )
+                printf( "Error: %s round trip failed\n", label );
+            else if( _measure( name, _readSlicesPass, &s, mb ) == 0 )
+                ret = 0;
+        }
+        fclose( s.fh );
+    }
+
+    free( s.slice );
+    free( s.data );
+    free( s.header );
+    free( s.readHeader );
+    return ret;
+}
+
+static int _buildParseHeaders( void *context )
+{   // Build and parse the standard header
+    mrcHeader *header = (mrcHeader*)context, parsed;
+    uint8_t headerBytes[MRC_HEADER_LEN];
+
+    for( int i = 0; i < N_HEADERS; i++ )
+    {
+        memset( &parsed, 0, sizeof(parsed) );
+        header->dimensions[2] = 16 + (i & 7);
+        _buildStandardHeader( header, headerBytes );
+        if( _parseStandardHeader( headerBytes, &parsed, "test_perf" ) != 0
+            || parsed.dimensions[2] != header->dimensions[2] )
+            return -1;
+    }
+    return 0;
+}
+
+static int _benchHeader()
+{
+    mrcHeader *header = _movieHeader( BLOSC_COMPRESSOR_ZSTD );
+    int ret = _measure( "header_build_parse", _buildParseHeaders, header, N_HEADERS );
+    free( header );
+    return ret;
+}
+
+static int _loadUncompressed( void *context )
+{   // readMRCZ of a plain MRC file, from the page cache
+    loadBench *l = (loadBench*)context;
+
+    if( l->loaded != NULL )
+        mrcVolume_free( l->loaded );
+    l->loaded = mrcVolume_new( NULL, NULL );
+    rewind( l->fh );
+    return readMRCZ( l->fh, l->loaded, "test_perf" ) > 0 ? 0 : -1;
+}
+
+static int _benchUncompressed()
+{
+    mrcHeader *header = _movieHeader( BLOSC_COMPRESSOR_NONE );
+    float *data = _movieData( header );
+    mrcVolume *source = mrcVolume_new( header, data );
+    size_t items = (size_t)header->dimensions[0] * header->dimensions[1] * header->dimensions[2];
+    loadBench l = { tmpfile(), NULL };
+    int ret = -1;
+
+    if( l.fh == NULL )
+        printf( "Error: could not create a temporary file\n" );
+    else if( writeMRCZ( l.fh, source ) != 0 || fflush( l.fh ) != 0 )
+        printf( "Error: could not write the uncompressed file\n" );
+    else if( _measure( "load_uncompressed", _loadUncompressed, &l, items * sizeof(float) / 1e6 ) == 0 )
+    {
+        if( memcmp( mrcVolume_data( l.loaded ), data, items * sizeof(float) ) != 0 )
+            printf( "Error: the uncompressed load differs from the file written\n" );
+        else
+            ret = 0;
+    }
+    if( l.fh != NULL )
+        fclose( l.fh );
+    if( l.loaded != NULL )
+        mrcVolume_free( l.loaded );
+    mrcVolume_free( source );
+    return ret;
+}
+
+static int _readBaseline( const char *filename )
+{
+    char line[256], name[64];
+    double rate;
+    FILE *fh = fopen( filename, "r" );
+    if( fh == NULL )
+        return -1;
+    while( fgets( line, sizeof(line), fh ) != NULL )
+    {
+        if( line[0] == '#' || sscanf( line, "%63s %lf", name, &rate ) != 2 )
+            continue;
+        for( int i = 0; i < _nBenchmarks; i++ )
+        {
+            if( strcmp( _benchmarks[i].name, name ) == 0 )
+                _benchmarks[i].baseline = rate;
+        }
+    }
+    fclose( fh );
+    return 0;
+}
+
+static int _writeBaseline( const char *filename )
+{
+    FILE *fh = fopen( filename, "w" );
+    if( fh == NULL )
+    {
+        printf( "Error: could not write the baseline %s\n", filename );
+        return -1;
+    }
+    fprintf( fh, "# c-mrcz throughput baseline (MB/s, headers/s for header_build_parse), from test_perf\n" );
+    for( int i = 0; i < _nBenchmarks; i++ )
+        fprintf( fh, "%s %.1f\n", _benchmarks[i].name, _benchmarks[i].rate );
+    fclose( fh );
+    return 0;
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *baseline = NULL;
+    double tolerance = DEFAULT_TOLERANCE;
+    int update = 0, failures = 0;
+
+    for( int i = 1; i < argc; i++ )
+    {
+        if( strcmp( argv[i], "-b" ) == 0 && i + 1 < argc )
+            baseline = argv[++i];
+        else if( strcmp( argv[i], "-t" ) == 0 && i + 1 < argc )
+            tolerance = atof( argv[++i] );
+        else if( strcmp( argv[i], "-u" ) == 0 )
+            update = 1;
+    }
+    if( baseline == NULL )
+    {
+        printf( "Error: test_perf needs a baseline file, -b <file>, recorded with -u\n" );
+        return 1;
+    }
+
+    if( _benchHeader() != 0
+        || _benchSlices( "lz4", BLOSC_COMPRESSOR_LZ4 ) != 0
+        || _benchSlices( "zstd", BLOSC_COMPRESSOR_ZSTD ) != 0
+        || _benchUncompressed() != 0 )
+        return 1;
+
+    if( update )
+    {
+        if( _writeBaseline( baseline ) != 0 )
+            return 1;
+        printf( "test_perf: recorded %d benchmarks in %s\n", _nBenchmarks, baseline );
+        return 0;
+    }
+    if( _readBaseline( baseline ) != 0 )
+    {
+        printf( "Error: no baseline %s, record one with test_perf -b %s -u\n", baseline, baseline );
+        return 1;
+    }
+
+    printf( "%-24s %12s %12s\n", "benchmark", "rate", "baseline" );
+    for( int i = 0; i < _nBenchmarks; i++ )
+    {
+        benchmark *b = &_benchmarks[i];
+        const char *status = "ok";
+        if( b->baseline <= 0.0 )
+        {
+            status = "MISSING";
+            failures++;
+        }
+        else if( b->rate < (1.0 - tolerance) * b->baseline )
+        {
+            status = "SLOWER";
+            failures++;
+        }
+        printf( "%-24s %12.1f %12.1f  %s\n", b->name, b->rate, b->baseline, status );
+    }
+
+    printf( "test_perf: %d benchmarks, %d missing or more than %.0f %% below %s\n",
+            _nBenchmarks, failures, 100.0 * tolerance, baseline );
+    return failures == 0 ? 0 : 1;
+}
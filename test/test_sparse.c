@@ -0,0 +1,94 @@
+/*********************************************************************
+  Sparse (MRCZ_FLAG_SPARSE) round trips of tiny and mostly-empty slices.
+
+  Slices of 1x1 up to 4x4 pixels are smaller than an event list header plus
+  one event and must be stored dense, while larger all-zero or nearly empty
+  slices become event lists.  Every file is read back with readMRCZ() and
+  compared to what was written.
+
+  See LICENSE.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mrcz.h"
+
+static const int32_t _types[] = { MRC_INT8, MRC_INT16, MRC_FLOAT32, MRC_COMPLEX64, MRC_UINT16 };
+static const int32_t _sizes[] = { 1, 2, 3, 4, 64 };
+
+static int _roundTrip( int32_t mrcType, int32_t size, int pattern )
+{   // pattern 0: all zeros, 1: one non-zero byte per slice, 2: all non-zero
+    const char *filename = "test_sparse.mrcz";
+    mrcHeader *header = mrcHeader_new();
+    mrcVolume *source, *loaded;
+    size_t sliceBytes, nbytes;
+    uint8_t *data;
+    FILE *fh;
+    int failed = 0;
+
+    header->mrcType = mrcType;
+    header->blosc_compressor = BLOSC_COMPRESSOR_LZ4;
+    header->mrczFlags = MRCZ_FLAG_SPARSE | MRCZ_FLAG_CHECKSUM;
+    header->blosc_threads = 1;
+    header->dimensions[0] = size;
+    header->dimensions[1] = size;
+    header->dimensions[2] = 3;
+    sliceBytes = (size_t)size * size * mrcHeader_itemsize( header );
+    nbytes = sliceBytes * header->dimensions[2];
+
+    data = calloc( nbytes, 1 );
+    for( size_t k = 0; k < (size_t)header->dimensions[2]; k++ )
+    {
+        if( pattern == 1 )
+            data[k * sliceBytes + (k * 7) % sliceBytes] = (uint8_t)(1 + k);
+        else if( pattern == 2 )
+            memset( &data[k * sliceBytes], (int)(0x11 * (k + 1)), sliceBytes );
+    }
+    source = mrcVolume_new( header, data );
+
+    fh = fopen( filename, "wb" );
+    if( fh == NULL )
+        return 1;
+    if( writeMRCZ( fh, source ) != 0 || fclose( fh ) != 0 )
+    {
+        printf( "Error: writeMRCZ failed for type %d, %dx%d, pattern %d\n", mrcType, size, size, pattern );
+        mrcVolume_free( source );
+        return 1;
+    }
+
+    loaded = mrcVolume_new( NULL, NULL );
+    fh = fopen( filename, "rb" );
+    if( fh == NULL || !readMRCZ( fh, loaded, (char*)filename )
+        || memcmp( mrcVolume_data( loaded ), data, nbytes ) != 0 )
+    {
+        printf( "Error: sparse round trip failed for type %d, %dx%d, pattern %d\n",
+                mrcType, size, size, pattern );
+        failed = 1;
+    }
+    if( fh != NULL )
+        fclose( fh );
+
+    remove( filename );
+    mrcVolume_free( loaded );
+    mrcVolume_free( source );
+    return failed;
+}
+
+int main( void )
+{
+    int failures = 0, n = 0;
+
+    for( int t = 0; t < 5; t++ )
+    {
+        for( int s = 0; s < 5; s++ )
+        {
+            for( int pattern = 0; pattern < 3; pattern++, n++ )
+                failures += _roundTrip( _types[t], _sizes[s], pattern );
+        }
+    }
+    printf( "test_sparse: %d round trips, %d failures\n", n, failures );
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+/*********************************************************************
+  Multi-threaded stress test for the c-mrcz library.
+
+  Each thread repeatedly writes its own file with a different data type,
+  compressor and set of MRCZ filters, then reads it back with readMRCZ() and
+  readMRCZ_into() and compares the data.  Any shared state in the library
+  shows up as a mismatch or a crash.
+
+  See LICENSE.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mrcz.h"
+
+#define N_THREADS       8
+#define N_ITERATIONS    6
+
+typedef struct _stressJob
+{
+    int index;
+    int failures;
+} stressJob;
+
+static const int32_t _types[] = { MRC_INT8, MRC_INT16, MRC_FLOAT32, MRC_COMPLEX64, MRC_UINT16 };
+static const int32_t _compressors[] = { BLOSC_COMPRESSOR_LZ4, BLOSC_COMPRESSOR_ZSTD, BLOSC_COMPRESSOR_ZLIB };
+static const uint32_t _flags[] = { 0, MRCZ_FLAG_CHECKSUM, MRCZ_FLAG_DELTA | MRCZ_FLAG_CHECKSUM,
+                                   MRCZ_FLAG_SPLITCOMPLEX | MRCZ_FLAG_SPARSE };
+
+static uint32_t _lcg( uint32_t *state )
+{   // rand() is not reentrant, so each thread has its own generator
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static void _fillSparse( uint8_t *data, size_t nbytes, size_t itemsize, uint32_t *state )
+{   // Mostly zeros with a few small counts, like a counting-mode frame
+    memset( data, 0, nbytes );
+    for( size_t i = 0; i < nbytes; i += itemsize )
+    {
+        if( _lcg( state ) % 16 == 0 )
+            data[i] = (uint8_t)(1 + _lcg( state ) % 4);
+    }
+}
+
+static int _stressOnce( stressJob *job, int iteration )
+{
+    char filename[64];
+    uint32_t state = 1000u * job->index + iteration;
+    int combo = job->index + iteration;
+    mrcHeader *header = mrcHeader_new(), *intoHeader = mrcHeader_new();
+    mrcVolume *source, *loaded;
+    size_t nbytes, itemsize;
+    uint8_t *data, *into;
+    FILE *fh;
+    int failed = 0;
+
+    header->mrcType = _types[combo % 5];
+    header->blosc_compressor = _compressors[combo % 3];
+    header->mrczFlags = _flags[combo % 4];
+    header->blosc_threads = 1 + combo % 2;
+    header->dimensions[0] = 64;
+    header->dimensions[1] = 48;
+    header->dimensions[2] = 10 + job->index;
+    itemsize = mrcHeader_itemsize( header );
+    nbytes = (size_t)header->dimensions[0] * header->dimensions[1] * header->dimensions[2] * itemsize;
+
+    data = malloc( nbytes );
+    _fillSparse( data, nbytes, itemsize, &state );
+    source = mrcVolume_new( header, data );
+
+    snprintf( filename, sizeof(filename), "test_threads_%d.mrcz", job->index );
+    fh = fopen( filename, "wb" );
+    if( fh == NULL )
+    {
+        printf( "Error: thread %d could not open %s\n", job->index, filename );
+        failed = 1;
+    }
+    else
+    {
+        if( writeMRCZ( fh, source ) != 0 )
+        {
+            printf( "Error: thread %d writeMRCZ failed on iteration %d\n", job->index, iteration );
+            failed = 1;
+        }
+        if( fclose( fh ) != 0 )
+            failed = 1;
+    }
+
+    // Read back into a new volume
+    loaded = mrcVolume_new( NULL, NULL );
+    fh = fopen( filename, "rb" );
+    if( !failed && (fh == NULL || !readMRCZ( fh, loaded, filename )
+                    || memcmp( mrcVolume_data( loaded ), data, nbytes ) != 0) )
+    {
+        printf( "Error: thread %d readMRCZ mismatch on iteration %d (type %d, compressor %d, flags 0x%x)\n",
+                job->index, iteration, header->mrcType, header->blosc_compressor, header->mrczFlags );
+        failed = 1;
+    }
+    if( fh != NULL )
+        fclose( fh );
+
+    // Read back into our own buffer
+    into = malloc( nbytes );
+    fh = fopen( filename, "rb" );
+    if( !failed && (fh == NULL || readMRCZ_into( fh, intoHeader, into, nbytes ) != 0
+                    || memcmp( into, data, nbytes ) != 0) )
+    {
+        printf( "Error: thread %d readMRCZ_into mismatch on iteration %d\n", job->index, iteration );
+        failed = 1;
+    }
+    if( fh != NULL )
+        fclose( fh );
+
+    remove( filename );
+    free( into );
+    free( intoHeader );
+    mrcVolume_free( loaded );
+    mrcVolume_free( source );
+    return failed;
+}
+
+static void* _stressWorker( void *arg )
+{
+    stressJob *job = (stressJob*)arg;
+    for( int i = 0; i < N_ITERATIONS; i++ )
+        job->failures += _stressOnce( job, i );
+    return NULL;
+}
+
+int main( void )
+{
+    pthread_t threads[N_THREADS];
+    stressJob jobs[N_THREADS];
+    int failures = 0;
+
+    for( int t = 0; t < N_THREADS; t++ )
+    {
+        jobs[t].index = t;
+        jobs[t].failures = 0;
+        pthread_create( &threads[t], NULL, _stressWorker, &jobs[t] );
+    }
+    for( int t = 0; t < N_THREADS; t++ )
+    {
+        pthread_join( threads[t], NULL );
+        failures += jobs[t].failures;
+    }
+
+    printf( "test_threads: %d threads x %d iterations, %d failures\n", N_THREADS, N_ITERATIONS, failures );
+    return failures == 0 ? 0 : 1;
+}